@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -19,73 +19,283 @@
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "riscv.h"
+#include "list.h"
 #include "defs.h"
 #include "fs.h"
 #include "buf.h"
+#include "kstats.h"
 
-struct {
+// Buffers are found through a hash table keyed by (dev, blockno).
+// Each bucket has its own lock, which protects the bucket list
+// and the refcnt and used fields of the buffers on it, so a cache
+// hit takes only that lock. bcache.lock serializes misses: it
+// must be held to change a buffer's dev or blockno, to add or
+// remove buffers, and to move the clock hand that picks which
+// unused buffer to recycle. Lock order is bcache.lock, then one
+// bucket lock.
+//
+// Buffers come from a slab cache. There are at least NBUF; a
+// miss adds a buffer instead of recycling one while more than
+// BHIGH pages are free, and frees up to BSHRINK unused buffers
+// while fewer than BLOW are. kalloc() calls breclaim() when it
+// runs out of pages.
+#define NBUCKET 13
+#define BHASH(dev, blockno) (((dev) * 31 + (blockno)) % NBUCKET)
+
+#define BHIGH   1024
+#define BLOW    256
+#define BSHRINK 16
+
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct list bufs;
+  uint64 nhit;
+  uint64 nmiss;
+  uint64 nra;     // Blocks read ahead
+  uint64 nrahit;  // Blocks read ahead that a bread() then found
+};
 
-  // Linked list of all buffers, through prev/next.
-  // Sorted by how recently the buffer was used.
-  // head.next is most recent, head.prev is least.
-  struct buf head;
+struct {
+  struct spinlock lock;
+  struct slabcache *cache;
+  struct list bufs;         // Every buffer, in clock order
+  struct list_elem *hand;   // Clock hand into bufs
+  int nbuf;
+  uint64 nevict;
+  uint64 ngrow;
+  uint64 nshrink;
+  struct bucket bucket[NBUCKET];
 } bcache;
 
+// Allocate a buffer and put it on the clock.
+// Caller must hold bcache.lock.
+static struct buf*
+bnew(void)
+{
+  struct buf *b;
+
+  if((b = slaballoc(bcache.cache)) == 0)
+    return 0;
+  memset(b, 0, sizeof(*b));
+  initsleeplock(&b->lock, "buffer");
+  list_push_back(&bcache.bufs, &b->clock);
+  bcache.nbuf++;
+  return b;
+}
+
+// Take b, which is unused and on no bucket, off the clock and
+// free it. Caller must hold bcache.lock.
+static void
+bdrop(struct buf *b)
+{
+  if(bcache.hand == &b->clock)
+    bcache.hand = list_next(bcache.hand);
+  list_remove(&b->clock);
+  bcache.nbuf--;
+  slabfree(bcache.cache, b);
+}
+
 void
 binit(void)
 {
   struct buf *b;
+  struct bucket *bk;
 
   initlock(&bcache.lock, "bcache");
+  bcache.cache = slabcreate("buf", sizeof(struct buf));
+  list_init(&bcache.bufs);
+  bcache.hand = list_end(&bcache.bufs);
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++){
+    initlock(&bk->lock, "bcache.bucket");
+    list_init(&bk->bufs);
+  }
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+  // Every buffer starts out holding block 0 of device 0.
+  bk = &bcache.bucket[BHASH(0, 0)];
+  acquire(&bcache.lock);
+  for(int i = 0; i < NBUF; i++){
+    if((b = bnew()) == 0)
+      panic("binit");
+    list_push_back(&bk->bufs, &b->elem);
   }
+  release(&bcache.lock);
 }
 
-// Look through buffer cache for block on device dev.
-// If not found, allocate a buffer.
-// In either case, return locked buffer.
+// Return the buffer for block blockno of dev in bucket bk, with
+// a new reference, or 0. Caller must hold bk->lock.
 static struct buf*
-bget(uint dev, uint blockno)
+bfind(struct bucket *bk, uint dev, uint blockno)
 {
+  struct list_elem *e;
   struct buf *b;
 
-  acquire(&bcache.lock);
-
-  // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
+  for(e = list_begin(&bk->bufs); e != list_end(&bk->bufs); e = list_next(e)){
+    b = list_entry(e, struct buf, elem);
     if(b->dev == dev && b->blockno == blockno){
       b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
+      b->used = 1;
       return b;
     }
   }
+  return 0;
+}
 
-  // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+// Pick an unused buffer with the clock algorithm: sweep the hand
+// around the buffers, clearing used bits, until it finds one with
+// no references that has not been used since the last sweep.
+// Remove it from its bucket. Returns 0 if every buffer is in use.
+// Caller must hold bcache.lock.
+static struct buf*
+bvictim(void)
+{
+  struct buf *b;
+  struct bucket *bk;
+
+  for(int i = 0; i < 2*bcache.nbuf; i++){
+    if(bcache.hand == list_end(&bcache.bufs))
+      bcache.hand = list_begin(&bcache.bufs);
+    b = list_entry(bcache.hand, struct buf, clock);
+    bcache.hand = list_next(bcache.hand);
+    bk = &bcache.bucket[BHASH(b->dev, b->blockno)];
+    acquire(&bk->lock);
+    if(b->refcnt == 0){
+      if(b->used == 0){
+        list_remove(&b->elem);
+        release(&bk->lock);
+        return b;
+      }
+      b->used = 0;
+    }
+    release(&bk->lock);
+  }
+  return 0;
+}
+
+// Free up to n unused buffers, keeping at least NBUF.
+// Returns the number freed. Caller must hold bcache.lock.
+static int
+bshrink(int n)
+{
+  struct buf *b;
+  int i;
+
+  for(i = 0; i < n && bcache.nbuf > NBUF; i++){
+    if((b = bvictim()) == 0)
+      break;
+    bdrop(b);
+  }
+  bcache.nshrink += i;
+  return i;
+}
+
+// Free every unused buffer above NBUF, for kalloc() when it has
+// run out of pages. Returns the number freed.
+int
+breclaim(void)
+{
+  int n;
+
+  // kalloc() is called with bcache.lock held when the cache grows.
+  if(holding(&bcache.lock))
+    return 0;
+  acquire(&bcache.lock);
+  n = bshrink(bcache.nbuf);
+  release(&bcache.lock);
+  return n;
+}
+
+// Return the buffer for block blockno of dev with a new
+// reference, not locked. If it is not cached, add or recycle a
+// buffer for it, with valid == 0. Returns 0 if every buffer is in
+// use. ra says the caller is reading ahead, which is counted apart
+// from demand hits and misses.
+static struct buf*
+bref(uint dev, uint blockno, int ra)
+{
+  struct bucket *bk;
+  struct buf *b;
+  int nfree;
+
+  bk = &bcache.bucket[BHASH(dev, blockno)];
+
+  // Is the block already cached?
+  acquire(&bk->lock);
+  b = bfind(bk, dev, blockno);
+  if(b && !ra){
+    bk->nhit++;
+    if(b->ra){
+      b->ra = 0;
+      bk->nrahit++;
     }
   }
-  panic("bget: no buffers");
+  release(&bk->lock);
+  if(b)
+    return b;
+
+  // Not cached. Only misses insert into the table, so once
+  // bcache.lock is held the block cannot appear behind our back;
+  // but another miss may have inserted it before we got the lock.
+  acquire(&bcache.lock);
+  acquire(&bk->lock);
+  b = bfind(bk, dev, blockno);
+  if(b && !ra)
+    bk->nhit++;
+  release(&bk->lock);
+  if(b == 0){
+    nfree = kpages();
+    if(nfree < BLOW)
+      bshrink(BSHRINK);
+    if(nfree > BHIGH && (b = bnew()) != 0)
+      bcache.ngrow++;
+    if(b == 0){
+      if((b = bvictim()) == 0){
+        release(&bcache.lock);
+        return 0;
+      }
+      if(b->valid)
+        bcache.nevict++;
+    }
+    b->dev = dev;
+    b->blockno = blockno;
+    b->valid = 0;
+    b->refcnt = 1;
+    b->used = 1;
+    b->ra = ra;
+    acquire(&bk->lock);
+    list_push_front(&bk->bufs, &b->elem);
+    if(ra)
+      bk->nra++;
+    else
+      bk->nmiss++;
+    release(&bk->lock);
+  }
+  release(&bcache.lock);
+  return b;
+}
+
+// Drop a reference to an unlocked buffer.
+static void
+bput(struct buf *b)
+{
+  struct bucket *bk = &bcache.bucket[BHASH(b->dev, b->blockno)];
+
+  acquire(&bk->lock);
+  b->refcnt--;
+  release(&bk->lock);
+}
+
+// Look through buffer cache for block on device dev.
+// If not found, allocate a buffer.
+// In either case, return locked buffer.
+static struct buf*
+bget(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  if((b = bref(dev, blockno, 0)) == 0)
+    panic("bget: no buffers");
+  acquiresleep(&b->lock);
+  return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -102,6 +312,136 @@ bread(uint dev, uint blockno)
   return b;
 }
 
+// Start reading the n indicated blocks into the cache, skipping
+// those already there, without waiting for the disk. Runs of
+// consecutive blocks go to the disk as one request of up to
+// NDISKSEG blocks. Each buffer stays locked until its read
+// finishes, so a bread() of the block in the meantime waits.
+void
+breadahead(uint dev, uint *blocknos, int n)
+{
+  struct buf *run[NDISKSEG];
+  struct buf *b;
+  int nrun = 0;
+
+  for(int i = 0; i < n; i++){
+    if((b = bref(dev, blocknos[i], 1)) == 0)
+      break;
+    // Don't wait for a buffer that is in use; it is either
+    // valid already or being read.
+    if(b->valid || b->lock.locked){
+      bput(b);
+      b = 0;
+    } else {
+      acquiresleep(&b->lock);
+      if(b->valid){
+        releasesleep(&b->lock);
+        bput(b);
+        b = 0;
+      }
+    }
+
+    if(nrun > 0 && (b == 0 || nrun == NDISKSEG ||
+                    b->blockno != run[nrun-1]->blockno + 1)){
+      virtio_disk_startv(run, nrun, 0);
+      nrun = 0;
+    }
+    if(b){
+      b->async = 1;
+      run[nrun++] = b;
+    }
+  }
+  if(nrun > 0)
+    virtio_disk_startv(run, nrun, 0);
+}
+
+// Called by the disk driver when an asynchronous read of b
+// finishes: mark it valid, unlock it, and drop the reference
+// breadahead() took.
+void
+bdone(struct buf *b)
+{
+  b->async = 0;
+  b->valid = 1;
+  releasesleep(&b->lock);
+  bput(b);
+}
+
+// If the cache holds block blockno of dev, copy it to dst and
+// return 1; otherwise return 0.
+static int
+bpeek(uint dev, uint blockno, uchar *dst)
+{
+  struct bucket *bk = &bcache.bucket[BHASH(dev, blockno)];
+  struct buf *b;
+  int valid;
+
+  acquire(&bk->lock);
+  b = bfind(bk, dev, blockno);
+  release(&bk->lock);
+  if(b == 0)
+    return 0;
+  acquiresleep(&b->lock);
+  if((valid = b->valid) != 0)
+    memmove(dst, b->data, BSIZE);
+  releasesleep(&b->lock);
+  bput(b);
+  return valid;
+}
+
+// Read the n blocks blocknos[] of dev into dst[], without adding
+// them to the cache, for file data, which the page cache holds.
+// A block the cache does hold is copied from it, since the disk
+// may not have its latest contents yet (see log.c). The rest go
+// to the disk together, in runs of up to NDISKSEG consecutive
+// blocks, before waiting for any of them.
+//
+// The buffers for the disk come from bcache.cache but never enter
+// the cache. Allocating one may make kalloc() call breclaim(),
+// which frees cached buffers into the same slab cache; that is
+// safe because slaballoc() holds no lock while it calls kalloc().
+// Buffers are too big to keep a batch of them on the stack.
+void
+breadnc(uint dev, uint *blocknos, int n, uchar **dst)
+{
+  struct buf *b[NPCRA*(PGSIZE/BSIZE)], *run[NDISKSEG], *bp;
+  int i, nrun;
+
+  if(n > NELEM(b))
+    panic("breadnc");
+  nrun = 0;
+  for(i = 0; i < n; i++){
+    b[i] = 0;
+    if(bpeek(dev, blocknos[i], dst[i]))
+      continue;
+    if((b[i] = slaballoc(bcache.cache)) == 0){
+      // Out of memory: read it through the cache after all.
+      bp = bread(dev, blocknos[i]);
+      memmove(dst[i], bp->data, BSIZE);
+      brelsedata(bp);
+      continue;
+    }
+    memset(b[i], 0, sizeof(struct buf));
+    b[i]->dev = dev;
+    b[i]->blockno = blocknos[i];
+    if(nrun > 0 && (nrun == NDISKSEG || b[i]->blockno != run[nrun-1]->blockno + 1)){
+      virtio_disk_startv(run, nrun, 0);
+      nrun = 0;
+    }
+    run[nrun++] = b[i];
+  }
+  if(nrun > 0)
+    virtio_disk_startv(run, nrun, 0);
+
+  for(i = 0; i < n; i++){
+    if(b[i]){
+      virtio_disk_wait(b[i]);
+      memmove(dst[i], b[i]->data, BSIZE);
+      slabfree(bcache.cache, b[i]);
+    }
+  }
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -111,43 +451,108 @@ bwrite(struct buf *b)
   virtio_disk_rw(b, 1);
 }
 
+// Start writing b's contents to disk and return without waiting.
+// b must be locked, and stay locked until bwait(b) returns.
+void
+bwritestart(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bwritestart");
+  virtio_disk_start(b, 1);
+}
+
+// Start writing the n locked buffers in b[], like bwritestart().
+// Runs of consecutive blocks go to the disk as one request of up
+// to NDISKSEG blocks.
+void
+bwritestartv(struct buf **b, int n)
+{
+  int i, k;
+
+  for(i = 0; i < n; i += k){
+    if(!holdingsleep(&b[i]->lock))
+      panic("bwritestartv");
+    for(k = 1; i+k < n && k < NDISKSEG; k++){
+      if(b[i+k]->dev != b[i]->dev || b[i+k]->blockno != b[i+k-1]->blockno + 1)
+        break;
+    }
+    virtio_disk_startv(&b[i], k, 1);
+  }
+}
+
+// Wait for a bwritestart() of b to finish.
+void
+bwait(struct buf *b)
+{
+  virtio_disk_wait(b);
+}
+
 // Release a locked buffer.
-// Move to the head of the most-recently-used list.
 void
 brelse(struct buf *b)
 {
+  struct bucket *bk;
+
   if(!holdingsleep(&b->lock))
     panic("brelse");
 
   releasesleep(&b->lock);
 
-  acquire(&bcache.lock);
+  bk = &bcache.bucket[BHASH(b->dev, b->blockno)];
+  acquire(&bk->lock);
   b->refcnt--;
-  if (b->refcnt == 0) {
-    // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
-  }
-  
-  release(&bcache.lock);
+  release(&bk->lock);
+}
+
+// Release a locked buffer holding file data, which the page
+// cache also holds, and make it the first choice to recycle.
+void
+brelsedata(struct buf *b)
+{
+  struct bucket *bk = &bcache.bucket[BHASH(b->dev, b->blockno)];
+
+  acquire(&bk->lock);
+  b->used = 0;
+  release(&bk->lock);
+  brelse(b);
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = &bcache.bucket[BHASH(b->dev, b->blockno)];
+
+  acquire(&bk->lock);
   b->refcnt++;
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
 void
 bunpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = &bcache.bucket[BHASH(b->dev, b->blockno)];
+
+  acquire(&bk->lock);
   b->refcnt--;
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
+// Fill in the buffer cache section of ks.
+void
+bstats(struct kstats *ks)
+{
+  struct bucket *bk;
 
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++){
+    ks->bcache_nhit += bk->nhit;
+    ks->bcache_nmiss += bk->nmiss;
+    ks->bcache_nra += bk->nra;
+    ks->bcache_nrahit += bk->nrahit;
+    ks->bcache_nacquire += bk->lock.nacquire;
+    ks->bcache_ncontend += bk->lock.ncontend;
+  }
+  ks->bcache_nbuf = bcache.nbuf;
+  ks->bcache_nevict = bcache.nevict;
+  ks->bcache_ngrow = bcache.ngrow;
+  ks->bcache_nshrink = bcache.nshrink;
+  ks->bcache_nacquire += bcache.lock.nacquire;
+  ks->bcache_ncontend += bcache.lock.ncontend;
+}
@@ -1,12 +1,18 @@
+#include "kernel/list.h"
+
 struct buf {
   int valid;   // has data been read from disk?
   int disk;    // does disk "own" buf?
+  int async;   // call bdone() when the disk is done?
+  int ra;      // read ahead and not yet found by bread()?
+  struct buf *qnext; // next buf in the same disk request
   uint dev;
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
-  struct buf *next;
+  int used;    // referenced since the clock hand last passed?
+  struct list_elem elem; // hash bucket list
+  struct list_elem clock; // list of all buffers
   uchar data[BSIZE];
 };
 
@@ -8,4 +8,5 @@ struct cinfo {
   int used_disk_bytes;
   int nprocs;
   int nticks;
+  int weight;
 };
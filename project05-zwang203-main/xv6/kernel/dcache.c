@@ -0,0 +1,194 @@
+// Directory entry cache.
+//
+// Maps (dev, directory inum, name) to the inum and offset of the
+// directory entry, or to "no such entry". dirlookup() consults it
+// before reading the directory, and fills it in afterwards, so
+// resolving a path whose components have been seen before does
+// not read any directory blocks.
+//
+// Interface:
+// * dclookup() returns 1 and the cached answer on a hit.
+// * dcenter() records an answer; inum 0 records that the name
+//     is not in the directory.
+// * dcremove() forgets a name, dcpurge() a whole directory.
+//
+// Callers must hold the directory's inode lock, which is what
+// keeps a directory and its cache entries consistent. The
+// dcache lock only protects the table itself.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "list.h"
+#include "defs.h"
+#include "fs.h"
+#include "kstats.h"
+
+#define NDCACHE 256  // cached names
+#define NDCHASH 61   // hash buckets
+
+struct dentry {
+  struct list_elem elem;  // On a hash bucket list
+  struct list_elem lru;   // On dcache.lru, most recent first
+  uint dev;
+  uint dinum;             // Directory
+  uint inum;              // 0 for a negative entry
+  uint off;               // Offset of the dirent in the directory
+  char name[DIRSIZ];
+};
+
+struct {
+  struct spinlock lock;
+  struct dentry dentry[NDCACHE];
+  struct list lru;
+  struct list bucket[NDCHASH];
+
+  uint64 nhit;
+  uint64 nneg;    // hits on negative entries
+  uint64 nmiss;
+  uint64 nevict;
+} dcache;
+
+static uint
+dchash(uint dev, uint dinum, char *name)
+{
+  uint h = dev * 31 + dinum;
+
+  for(int i = 0; i < DIRSIZ && name[i]; i++)
+    h = h * 31 + (uchar)name[i];
+  return h % NDCHASH;
+}
+
+void
+dcinit(void)
+{
+  initlock(&dcache.lock, "dcache");
+  list_init(&dcache.lru);
+  for(int i = 0; i < NDCHASH; i++)
+    list_init(&dcache.bucket[i]);
+  for(int i = 0; i < NDCACHE; i++){
+    // Unused entries sit at the back of the LRU list, on no bucket.
+    dcache.dentry[i].dinum = 0;
+    list_push_back(&dcache.lru, &dcache.dentry[i].lru);
+  }
+}
+
+// Find the entry for name in directory dinum. Caller must
+// hold dcache.lock.
+static struct dentry*
+dcfind(uint dev, uint dinum, char *name)
+{
+  struct list *l = &dcache.bucket[dchash(dev, dinum, name)];
+  struct list_elem *e;
+  struct dentry *d;
+
+  for(e = list_begin(l); e != list_end(l); e = list_next(e)){
+    d = list_entry(e, struct dentry, elem);
+    if(d->dev == dev && d->dinum == dinum && namecmp(d->name, name) == 0)
+      return d;
+  }
+  return 0;
+}
+
+// Look up name in directory dinum. On a hit, set *inum to the
+// entry's inum, or 0 if the name is known not to exist, set *off
+// to its offset, and return 1. Return 0 on a miss.
+int
+dclookup(uint dev, uint dinum, char *name, uint *inum, uint *off)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  if((d = dcfind(dev, dinum, name)) == 0){
+    dcache.nmiss++;
+    release(&dcache.lock);
+    return 0;
+  }
+  list_remove(&d->lru);
+  list_push_front(&dcache.lru, &d->lru);
+  *inum = d->inum;
+  *off = d->off;
+  if(d->inum)
+    dcache.nhit++;
+  else
+    dcache.nneg++;
+  release(&dcache.lock);
+  return 1;
+}
+
+// Record that name in directory dinum is inum, in the dirent at
+// offset off, or that there is no such name if inum is 0.
+void
+dcenter(uint dev, uint dinum, char *name, uint inum, uint off)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  if((d = dcfind(dev, dinum, name)) == 0){
+    // Recycle the least recently used entry.
+    d = list_entry(list_back(&dcache.lru), struct dentry, lru);
+    if(d->dinum){
+      list_remove(&d->elem);
+      dcache.nevict++;
+    }
+    d->dev = dev;
+    d->dinum = dinum;
+    strncpy(d->name, name, DIRSIZ);
+    list_push_front(&dcache.bucket[dchash(dev, dinum, name)], &d->elem);
+  }
+  d->inum = inum;
+  d->off = off;
+  list_remove(&d->lru);
+  list_push_front(&dcache.lru, &d->lru);
+  release(&dcache.lock);
+}
+
+// Drop d and make it the next entry to recycle. Caller must hold
+// dcache.lock.
+static void
+dcdrop(struct dentry *d)
+{
+  list_remove(&d->elem);
+  d->dinum = 0;
+  list_remove(&d->lru);
+  list_push_back(&dcache.lru, &d->lru);
+}
+
+// Forget what is known about name in directory dinum.
+void
+dcremove(uint dev, uint dinum, char *name)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  if((d = dcfind(dev, dinum, name)) != 0)
+    dcdrop(d);
+  release(&dcache.lock);
+}
+
+// Forget every name in directory dinum, which is being freed.
+void
+dcpurge(uint dev, uint dinum)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  for(d = dcache.dentry; d < &dcache.dentry[NDCACHE]; d++){
+    if(d->dinum == dinum && d->dev == dev)
+      dcdrop(d);
+  }
+  release(&dcache.lock);
+}
+
+// Fill in the dcache section of ks.
+void
+dcstats(struct kstats *ks)
+{
+  acquire(&dcache.lock);
+  ks->dc_nhit = dcache.nhit;
+  ks->dc_nneg = dcache.nneg;
+  ks->dc_nmiss = dcache.nmiss;
+  ks->dc_nevict = dcache.nevict;
+  release(&dcache.lock);
+}
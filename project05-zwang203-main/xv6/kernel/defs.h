@@ -10,14 +10,25 @@ struct sleeplock;
 struct stat;
 struct superblock;
 struct uproc;
+struct kstats;
+struct slabcache;
 
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bwritestart(struct buf*);
+void            bwritestartv(struct buf**, int);
+void            bwait(struct buf*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
+void            bstats(struct kstats*);
+void            breadahead(uint, uint*, int);
+void            bdone(struct buf*);
+int             breclaim(void);
+void            breadnc(uint, uint*, int, uchar**);
+void            brelsedata(struct buf*);
 
 // console.c
 void            consoleinit(void);
@@ -27,6 +38,7 @@ void            consw(int);
 
 // exec.c
 int             exec(char*, char**);
+void            execstats(struct kstats*);
 
 // file.c
 struct file*    filealloc(void);
@@ -40,9 +52,14 @@ int             filewrite(struct file*, uint64, int n);
 // fs.c
 void            fsinit(int);
 int             dirlink(struct inode*, char*, uint);
+void            dirunlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
+int             itextget(struct inode*);
+void            itextput(struct inode*);
+int             iwriteget(struct inode*);
+void            iwriteput(struct inode*);
 void            iinit();
 void            ilock(struct inode*);
 void            iput(struct inode*);
@@ -53,9 +70,38 @@ int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, int, uint64, uint, uint);
+void            ireadpages(struct inode*, uint, int, char**);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
 void            itrunc(struct inode*);
+void            fsstats(struct kstats*);
+void            istats(struct kstats*);
+
+// pcache.c
+void            pcinit(void);
+char*           pcget(struct inode*, uint);
+void            pcupdate(struct inode*, uint, char*, uint);
+void            pcpurge(struct inode*);
+int             pcreclaim(void);
+void            pcstats(struct kstats*);
+
+// mmap.c
+uint64          mmap(uint64, int, int, struct file*, uint);
+int             munmap(uint64, uint64);
+int             mmapfault(struct proc*, uint64, int);
+void            mmaptouch(struct proc*, uint64, uint64);
+int             mmapfork(struct proc*, struct proc*);
+void            mmapexit(struct proc*);
+uint64          mmapbase(struct proc*);
+void            mmapstats(struct kstats*);
+
+// dcache.c
+void            dcinit(void);
+int             dclookup(uint, uint, char*, uint*, uint*);
+void            dcenter(uint, uint, char*, uint, uint);
+void            dcremove(uint, uint, char*);
+void            dcpurge(uint, uint);
+void            dcstats(struct kstats*);
 
 // ramdisk.c
 void            ramdiskinit(void);
@@ -66,14 +112,31 @@ void            ramdiskrw(struct buf*);
 void*           kalloc(void);
 void            kfree(void *);
 void            kinit(void);
+void            kref(void *);
+int             krefcnt(void *);
+int             kpages(void);
+void            kallocstats(struct kstats*);
+void*           kalloc_order(int);
+void            kfree_order(void *, int);
+
+// slab.c
+struct slabcache* slabcreate(char*, uint);
+void*           slaballoc(struct slabcache*);
+void            slabfree(struct slabcache*, void*);
+void            slabstats(struct kstats*);
 
 // log.c
 void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
 void            begin_op(void);
 void            end_op(void);
+void            begin_opn(int);
+void            end_opn(int);
+int             log_opmax(void);
+void            logstats(struct kstats*);
 
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
@@ -111,10 +174,14 @@ void            yield(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
+void            kthread(char*, void (*)(void));
 int             sproc(int, uint64);
 void            contdump(void);
 int             cfork(char*, int, char*, int);
 int             cinfo(uint64);
+int             cweight(char*, int);
+void            contmem(struct cont*, int);
+void            proctick(struct proc*);
 
 // swtch.S
 void            swtch(struct context*, struct context*);
@@ -122,6 +189,7 @@ void            swtch(struct context*, struct context*);
 // spinlock.c
 void            acquire(struct spinlock*);
 int             holding(struct spinlock*);
+int             holdingany(void);
 void            initlock(struct spinlock*, char*);
 void            release(struct spinlock*);
 void            push_off(void);
@@ -156,6 +224,10 @@ void            trapinit(void);
 void            trapinithart(void);
 extern struct spinlock tickslock;
 void            usertrapret(void);
+void            timer_add(struct proc*, uint);
+void            timer_cancel(struct proc*);
+void            timer_done(struct proc*);
+void            timerstats(struct kstats*);
 
 // uart.c
 void            uartinit(void);
@@ -174,6 +246,9 @@ void            uvmfirst(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64, int);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
 int             uvmcopy(pagetable_t, pagetable_t, uint64);
+int             uvmdup(pagetable_t, pagetable_t, uint64, uint64, int);
+int             uvmcow(pagetable_t, uint64);
+int             uvmlazy(pagetable_t, uint64, uint64);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
@@ -192,6 +267,10 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+void            virtio_disk_start(struct buf *, int);
+void            virtio_disk_startv(struct buf **, int, int);
+void            virtio_disk_wait(struct buf *);
+void            virtio_disk_stats(struct kstats*);
 void            virtio_disk_intr(void);
 
 // number of elements in fixed-size array
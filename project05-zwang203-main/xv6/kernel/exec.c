@@ -6,8 +6,12 @@
 #include "proc.h"
 #include "defs.h"
 #include "elf.h"
+#include "kstats.h"
 
-static int loadseg(pde_t *, uint64, struct inode *, uint, uint);
+static uint64 mapseg(pagetable_t, uint64, struct inode *, struct proghdr *);
+
+uint64 exec_nshared;  // pages mapped from the page cache
+uint64 exec_ncopied;  // pages copied or zeroed
 
 int flags2perm(int flags)
 {
@@ -26,7 +30,7 @@ exec(char *path, char **argv)
   int i, off;
   uint64 argc, sz = 0, sp, ustack[MAXARG], stackbase;
   struct elfhdr elf;
-  struct inode *ip;
+  struct inode *ip, *text = 0, *oldtext;
   struct proghdr ph;
   pagetable_t pagetable = 0, oldpagetable;
   struct proc *p = myproc();
@@ -46,6 +50,13 @@ exec(char *path, char **argv)
   if(elf.magic != ELF_MAGIC)
     goto bad;
 
+  // The program's pages come from the page cache, so it must not
+  // be open for writing. The reference namei() took stays with
+  // the process, in p->text.
+  if(itextget(ip) < 0)
+    goto bad;
+  text = ip;
+
   if((pagetable = proc_pagetable(p)) == 0)
     goto bad;
 
@@ -61,14 +72,14 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
+    if(ph.vaddr < PGROUNDUP(sz))
+      goto bad;
     uint64 sz1;
-    if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz, flags2perm(ph.flags))) == 0)
+    if((sz1 = mapseg(pagetable, sz, ip, &ph)) == 0)
       goto bad;
     sz = sz1;
-    if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
-      goto bad;
   }
-  iunlockput(ip);
+  iunlock(ip);
   end_op();
   ip = 0;
 
@@ -121,46 +132,109 @@ exec(char *path, char **argv)
   safestrcpy(p->name, last, sizeof(p->name));
     
   // Commit to the user image.
+  mmapexit(p);
   oldpagetable = p->pagetable;
   p->pagetable = pagetable;
   p->sz = sz;
+  contmem(p->contp, sz - oldsz);
   p->trapframe->epc = elf.entry;  // initial program counter = main
   p->trapframe->sp = sp; // initial stack pointer
   proc_freepagetable(oldpagetable, oldsz);
+  oldtext = p->text;
+  p->text = text;
+  if(oldtext){
+    itextput(oldtext);
+    begin_op();
+    iput(oldtext);
+    end_op();
+  }
 
   return argc; // this ends up in a0, the first argument to main(argc, argv)
 
  bad:
   if(pagetable)
     proc_freepagetable(pagetable, sz);
+  if(text)
+    itextput(text);
   if(ip){
     iunlockput(ip);
     end_op();
+  } else if(text){
+    begin_op();
+    iput(text);
+    end_op();
   }
   return -1;
 }
 
-// Load a program segment into pagetable at virtual address va.
-// va must be page-aligned
-// and the pages from va to va+sz must already be mapped.
-// Returns 0 on success, -1 on failure.
-static int
-loadseg(pagetable_t pagetable, uint64 va, struct inode *ip, uint offset, uint sz)
+// Map program segment ph of ip into pagetable, which holds the
+// program up to sz, and return the new size, or 0 on failure.
+// ph->vaddr must be page-aligned and at least sz.
+//
+// Pages that hold only file data are mapped straight from the
+// page cache, so every process running the program shares them:
+// read-only, or copy-on-write if the segment is writable. The
+// rest (a writable segment's last partial page, and bss) are
+// private copies. No one can open the file for writing while a
+// process runs it (see itextget()), so the shared pages do not
+// change under it. Caller must hold ip->lock.
+static uint64
+mapseg(pagetable_t pagetable, uint64 sz, struct inode *ip, struct proghdr *ph)
 {
-  uint i, n;
-  uint64 pa;
-
-  for(i = 0; i < sz; i += PGSIZE){
-    pa = walkaddr(pagetable, va + i);
-    if(pa == 0)
-      panic("loadseg: address should exist");
-    if(sz - i < PGSIZE)
-      n = sz - i;
-    else
-      n = PGSIZE;
-    if(readi(ip, 0, (uint64)pa, offset+i, n) != n)
-      return -1;
+  uint64 a, i, end;
+  int perm, share;
+  uint n;
+  char *mem;
+
+  if(PGROUNDUP(sz) < ph->vaddr &&
+     uvmalloc(pagetable, sz, ph->vaddr, PTE_W) == 0)
+    return 0;
+  perm = PTE_R | PTE_U | flags2perm(ph->flags);
+  end = ph->vaddr + ph->memsz;
+  for(a = ph->vaddr; a < end; a += PGSIZE){
+    i = a - ph->vaddr;
+    // A read-only page may run on into file data past the
+    // segment, which is harmless, but not into bss.
+    share = ph->off % PGSIZE == 0 && i < ph->filesz &&
+            (i + PGSIZE <= ph->filesz || (!(perm & PTE_W) && ph->memsz == ph->filesz));
+    if(share){
+      if((mem = pcget(ip, (ph->off + i) / PGSIZE)) == 0)
+        goto bad;
+      if(mappages(pagetable, a, PGSIZE, (uint64)mem,
+                  perm & PTE_W ? (perm & ~PTE_W) | PTE_COW : perm) != 0){
+        kfree(mem);
+        goto bad;
+      }
+      __sync_fetch_and_add(&exec_nshared, 1);
+      continue;
+    }
+    if((mem = kalloc()) == 0)
+      goto bad;
+    memset(mem, 0, PGSIZE);
+    if(i < ph->filesz){
+      n = ph->filesz - i < PGSIZE ? ph->filesz - i : PGSIZE;
+      if(readi(ip, 0, (uint64)mem, ph->off + i, n) != n){
+        kfree(mem);
+        goto bad;
+      }
+    }
+    if(mappages(pagetable, a, PGSIZE, (uint64)mem, perm) != 0){
+      kfree(mem);
+      goto bad;
+    }
+    __sync_fetch_and_add(&exec_ncopied, 1);
   }
-  
+  return end;
+
+ bad:
+  uvmdealloc(pagetable, a, sz);
   return 0;
 }
+
+// Fill in the exec section of ks.
+void
+execstats(struct kstats *ks)
+{
+  ks->exec_nshared = exec_nshared;
+  ks->exec_ncopied = exec_ncopied;
+}
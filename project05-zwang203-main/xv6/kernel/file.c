@@ -14,15 +14,18 @@
 #include "proc.h"
 
 struct devsw devsw[NDEV];
+// File structures come from a slab cache, so the number of open
+// files is limited only by memory. ftable.lock protects f->ref.
 struct {
   struct spinlock lock;
-  struct file file[NFILE];
+  struct slabcache *cache;
 } ftable;
 
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
+  ftable.cache = slabcreate("file", sizeof(struct file));
 }
 
 // Allocate a file structure.
@@ -31,16 +34,11 @@ filealloc(void)
 {
   struct file *f;
 
-  acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
-  }
-  release(&ftable.lock);
-  return 0;
+  if((f = slaballoc(ftable.cache)) == 0)
+    return 0;
+  memset(f, 0, sizeof(*f));
+  f->ref = 1;
+  return f;
 }
 
 // Increment ref count for file f.
@@ -72,10 +70,13 @@ fileclose(struct file *f)
   f->ref = 0;
   f->type = FD_NONE;
   release(&ftable.lock);
+  slabfree(ftable.cache, f);
 
   if(ff.type == FD_PIPE){
     pipeclose(ff.pipe, ff.writable);
   } else if(ff.type == FD_INODE || ff.type == FD_DEVICE){
+    if(ff.type == FD_INODE && ff.writable && ff.ip->type == T_FILE)
+      iwriteput(ff.ip);
     begin_op();
     iput(ff.ip);
     end_op();
@@ -111,6 +112,8 @@ fileread(struct file *f, uint64 addr, int n)
   if(f->readable == 0)
     return -1;
 
+  if(n > 0)
+    mmaptouch(myproc(), addr, n);
   if(f->type == FD_PIPE){
     r = piperead(f->pipe, addr, n);
   } else if(f->type == FD_DEVICE){
@@ -139,6 +142,8 @@ filewrite(struct file *f, uint64 addr, int n)
   if(f->writable == 0)
     return -1;
 
+  if(n > 0)
+    mmaptouch(myproc(), addr, n);
   if(f->type == FD_PIPE){
     ret = pipewrite(f->pipe, addr, n);
   } else if(f->type == FD_DEVICE){
@@ -146,25 +151,28 @@ filewrite(struct file *f, uint64 addr, int n)
       return -1;
     ret = devsw[f->major].write(f->minor, 1, addr, n);
   } else if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
+    // write as many blocks at a time as fit in the log.
+    // writing k blocks reserves 2*(k+1) + 1 + 2 log blocks:
+    // each data block and its bitmap block, one more of each
+    // for a partial first block, the i-node, and two levels
+    // of indirect blocks. max is the largest k for which that
+    // fits, e.g. 12 blocks for a 29-block log.
     // this really belongs lower down, since writei()
     // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+    int max = ((log_opmax()-1-2) / 2 - 1) * BSIZE;
     int i = 0;
     while(i < n){
       int n1 = n - i;
       if(n1 > max)
         n1 = max;
+      int nblocks = 2 * ((n1 + BSIZE - 1) / BSIZE + 1) + 1 + 2;
 
-      begin_op();
+      begin_opn(nblocks);
       ilock(f->ip);
       if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
         f->off += r;
       iunlock(f->ip);
-      end_op();
+      end_opn(nblocks);
 
       if(r != n1){
         // error from writei
@@ -1,3 +1,5 @@
+#include "kernel/list.h"
+
 struct file {
   enum { FD_NONE, FD_PIPE, FD_INODE, FD_DEVICE } type;
   int ref; // reference count
@@ -19,6 +21,10 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  int ntext;          // Processes running it, see itextget()
+  int nwriter;        // Open files that may write it
+  struct list_elem elem; // On an itable hash bucket
+  struct list_elem lru;  // On itable.lru while ref is 0
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -27,7 +33,13 @@ struct inode {
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint addrs[NDIRECT+2];
+
+  uint ralast;        // last block readi() read
+  uint rawin;         // read-ahead window; 0 if reads are not sequential
+  uint ranext;        // next block to read ahead
+  uint goal;          // where bmap() allocates next; 0 if unknown
+  struct dirindex *dx; // index of a large directory, or 0
 };
 
 // map major device number to device functions.
@@ -20,12 +20,41 @@
 #include "fs.h"
 #include "buf.h"
 #include "file.h"
+#include "kstats.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 // there should be one superblock per disk device, but we run with
 // only one device
 struct superblock sb; 
 
+// In-memory summary of free space, built from the bitmap and the
+// inode blocks at boot. balloc() and ialloc() use it to skip full
+// blocks and to start where the last allocation left off, instead
+// of scanning from the start of the disk. The counts change under
+// lock, with the bitmap or inode block held as well; the scans read
+// them without the lock, as hints.
+struct {
+  struct spinlock lock;
+  int nbmap;      // Bitmap blocks
+  int niblk;      // Inode blocks
+  int *bfree;     // Free blocks per bitmap block
+  int *ifree;     // Free inodes per inode block
+  uint bcursor;   // Block after the last one allocated
+  uint icursor;   // Inode after the last one allocated
+  uint64 nballoc;
+  uint64 nbscan;  // Bitmap blocks read by balloc()
+  uint64 nialloc;
+  uint64 niscan;  // Inode blocks read by ialloc()
+  // The lookup counters below are added to atomically, without
+  // the lock.
+  uint64 nnamei;
+  uint64 nameitime; // r_time() cycles spent in namex()
+  uint64 ndxbuild;  // directory indexes built
+  uint64 ndxprobe;  // dirents read by indexed lookups
+} fsum;
+
+static void fsuminit(int);
+
 // Read the super block.
 static void
 readsb(int dev, struct superblock *sb)
@@ -44,6 +73,7 @@ fsinit(int dev) {
   if(sb.magic != FSMAGIC)
     panic("invalid file system");
   initlog(dev, &sb);
+  fsuminit(dev);
 }
 
 // Zero a block.
@@ -60,29 +90,89 @@ bzero(int dev, int bno)
 
 // Blocks.
 
-// Allocate a zeroed disk block.
+// Number of zero bits in w.
+static int
+nzero(uint64 w)
+{
+  int n;
+
+  for(n = 0, w = ~w; w; w &= w - 1)
+    n++;
+  return n;
+}
+
+// Index of the lowest zero bit in w, which must have one.
+static int
+firstzero(uint64 w)
+{
+  int i;
+
+  w = ~w;
+  for(i = 0; (w & 0xff) == 0; i += 8)
+    w >>= 8;
+  for(; (w & 1) == 0; i++)
+    w >>= 1;
+  return i;
+}
+
+// Allocate a zeroed disk block, the first free one at or
+// after goal, so that a file written in order gets a run of
+// consecutive blocks. With no goal, start after the block
+// allocated last. The bitmap is scanned 64 bits at a time, and
+// bitmap blocks with nothing free are not read at all.
 // returns 0 if out of disk space.
 static uint
-balloc(uint dev)
+balloc(uint dev, uint goal)
 {
-  int b, bi, m;
+  int bb, i, w, nscan;
+  uint b;
+  uint64 *a, x, skip;
   struct buf *bp;
 
-  bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
-    bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
+  if(goal == 0 || goal >= sb.size)
+    goal = fsum.bcursor;
+  if(goal >= sb.size)
+    goal = 0;
+
+  // Scan from goal to the end of the bitmap, then wrap around to
+  // the start of goal's bitmap block.
+  bb = goal / BPB;
+  w = (goal % BPB) / 64;
+  skip = ((uint64)1 << (goal % 64)) - 1;  // bits before goal
+  nscan = 0;
+  for(i = 0; i <= fsum.nbmap; i++){
+    if(fsum.bfree[bb] > 0){
+      bp = bread(dev, sb.bmapstart + bb);
+      nscan++;
+      a = (uint64*)bp->data;
+      for(; w < BPB / 64; w++, skip = 0){
+        if((x = a[w] | skip) == ~(uint64)0)
+          continue;
+        b = bb * BPB + w * 64 + firstzero(x);
+        if(b >= sb.size)
+          break;
+        a[w] |= (uint64)1 << (b % 64);  // Mark block in use.
         log_write(bp);
+        acquire(&fsum.lock);
+        fsum.bfree[bb]--;
+        fsum.bcursor = b + 1;
+        fsum.nballoc++;
+        fsum.nbscan += nscan;
+        release(&fsum.lock);
         brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
+        bzero(dev, b);
+        return b;
       }
+      brelse(bp);
     }
-    brelse(bp);
+    bb = (bb + 1) % fsum.nbmap;
+    w = 0;
+    skip = 0;
   }
+  acquire(&fsum.lock);
+  fsum.nballoc++;
+  fsum.nbscan += nscan;
+  release(&fsum.lock);
   printf("balloc: out of blocks\n");
   return 0;
 }
@@ -101,9 +191,61 @@ bfree(int dev, uint b)
     panic("freeing free block");
   bp->data[bi/8] &= ~m;
   log_write(bp);
+  acquire(&fsum.lock);
+  fsum.bfree[b / BPB]++;
+  release(&fsum.lock);
   brelse(bp);
 }
 
+// Count the free blocks and inodes on dev into fsum.
+static void
+fsuminit(int dev)
+{
+  struct buf *bp;
+  struct dinode *dip;
+  uint64 *a, x;
+  uint base;
+  int i, j;
+
+  fsum.nbmap = (sb.size + BPB - 1) / BPB;
+  fsum.niblk = sb.ninodes / IPB + 1;
+  if((fsum.nbmap + fsum.niblk) * sizeof(int) > PGSIZE)
+    panic("fsuminit: too big");
+  if((fsum.bfree = kalloc()) == 0)
+    panic("fsuminit: kalloc");
+  fsum.ifree = fsum.bfree + fsum.nbmap;
+
+  for(i = 0; i < fsum.nbmap; i++){
+    fsum.bfree[i] = 0;
+    bp = bread(dev, sb.bmapstart + i);
+    a = (uint64*)bp->data;
+    for(j = 0; j < BPB / 64; j++){
+      base = i * BPB + j * 64;
+      if(base >= sb.size)
+        break;
+      x = a[j];
+      if(sb.size - base < 64)
+        x |= ~(uint64)0 << (sb.size - base);  // past the end
+      fsum.bfree[i] += nzero(x);
+    }
+    brelse(bp);
+  }
+
+  for(i = 0; i < fsum.niblk; i++){
+    fsum.ifree[i] = 0;
+    bp = bread(dev, sb.inodestart + i);
+    for(j = 0; j < IPB; j++){
+      if(i * IPB + j == 0 || i * IPB + j >= sb.ninodes)
+        continue;
+      dip = (struct dinode*)bp->data + j;
+      if(dip->type == 0)
+        fsum.ifree[i]++;
+    }
+    brelse(bp);
+  }
+  fsum.icursor = 1;
+}
+
 // Inodes.
 //
 // An inode describes a single unnamed file.
@@ -164,32 +306,51 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
-// The itable.lock spin-lock protects the allocation of itable
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold itable.lock while using any of those fields.
+// The itable is a hash table keyed by (dev, inum) of every
+// in-memory inode. Entries come from a slab cache, so the table
+// grows on demand. When an entry's ref drops to zero it stays in
+// the table, still valid, on the itable.lru list, so that a later
+// iget() and ilock() of the same inode need not read the disk.
+// At most NINODE such entries are kept; the least recently used
+// ones go back to the slab cache. The itable.lock spin-lock
+// protects the hash buckets and the LRU list, and since ip->dev
+// and ip->inum indicate which i-node an entry holds, one must
+// hold itable.lock while using ip->ref, ip->dev or ip->inum.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+#define NIHASH 31
+#define IHASH(dev, inum) (((dev) * 31 + (inum)) % NIHASH)
+
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct list bucket[NIHASH];
+  struct list lru;      // Entries with ref 0, most recent first
+  int nlru;
+  int ninode;           // Entries in the table
+  struct slabcache *cache;
+
+  uint64 nhit;          // iget()s that found the inode
+  uint64 nmiss;
+  uint64 nevict;        // Unreferenced entries dropped
+  uint64 nread;         // ilock()s that read the disk
 } itable;
 
 void
 iinit()
 {
-  int i = 0;
-  
   initlock(&itable.lock, "itable");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&itable.inode[i].lock, "inode");
-  }
+  initlock(&fsum.lock, "fsum");
+  for(int i = 0; i < NIHASH; i++)
+    list_init(&itable.bucket[i]);
+  list_init(&itable.lru);
+  itable.cache = slabcreate("inode", sizeof(struct inode));
 }
 
 static struct inode* iget(uint dev, uint inum);
+static void dxdrop(struct inode*);
 
 // Allocate an inode on device dev.
 // Mark it as allocated by  giving it type type.
@@ -198,22 +359,44 @@ static struct inode* iget(uint dev, uint inum);
 struct inode*
 ialloc(uint dev, short type)
 {
-  int inum;
+  int inum, i, ib, j, nscan;
   struct buf *bp;
   struct dinode *dip;
 
-  for(inum = 1; inum < sb.ninodes; inum++){
-    bp = bread(dev, IBLOCK(inum, sb));
-    dip = (struct dinode*)bp->data + inum%IPB;
-    if(dip->type == 0){  // a free inode
-      memset(dip, 0, sizeof(*dip));
-      dip->type = type;
-      log_write(bp);   // mark it allocated on the disk
-      brelse(bp);
-      return iget(dev, inum);
+  // Start at the block of the inode allocated last, and skip
+  // blocks with no free inodes.
+  ib = fsum.icursor / IPB;
+  nscan = 0;
+  for(i = 0; i < fsum.niblk; i++, ib = (ib + 1) % fsum.niblk){
+    if(fsum.ifree[ib] == 0)
+      continue;
+    bp = bread(dev, sb.inodestart + ib);
+    nscan++;
+    for(j = 0; j < IPB; j++){
+      inum = ib * IPB + j;
+      if(inum == 0 || inum >= sb.ninodes)
+        continue;
+      dip = (struct dinode*)bp->data + j;
+      if(dip->type == 0){  // a free inode
+        memset(dip, 0, sizeof(*dip));
+        dip->type = type;
+        log_write(bp);   // mark it allocated on the disk
+        acquire(&fsum.lock);
+        fsum.ifree[ib]--;
+        fsum.icursor = inum + 1;
+        fsum.nialloc++;
+        fsum.niscan += nscan;
+        release(&fsum.lock);
+        brelse(bp);
+        return iget(dev, inum);
+      }
     }
     brelse(bp);
   }
+  acquire(&fsum.lock);
+  fsum.nialloc++;
+  fsum.niscan += nscan;
+  release(&fsum.lock);
   printf("ialloc: no inodes\n");
   return 0;
 }
@@ -246,31 +429,54 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip;
+  struct list *l;
+  struct list_elem *e;
 
   acquire(&itable.lock);
 
   // Is the inode already in the table?
-  empty = 0;
-  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  l = &itable.bucket[IHASH(dev, inum)];
+  for(e = list_begin(l); e != list_end(l); e = list_next(e)){
+    ip = list_entry(e, struct inode, elem);
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0){
+        list_remove(&ip->lru);
+        itable.nlru--;
+      }
+      itable.nhit++;
       release(&itable.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
+  }
+  itable.nmiss++;
+
+  // Allocate a new entry, or recycle the least recently used
+  // unreferenced one if memory is short.
+  if((ip = slaballoc(itable.cache)) == 0){
+    if(list_empty(&itable.lru))
+      panic("iget: no inodes");
+    ip = list_entry(list_pop_back(&itable.lru), struct inode, lru);
+    itable.nlru--;
+    itable.nevict++;
+    list_remove(&ip->elem);
+    dxdrop(ip);
+  } else {
+    itable.ninode++;
   }
 
-  // Recycle an inode entry.
-  if(empty == 0)
-    panic("iget: no inodes");
-
-  ip = empty;
+  initsleeplock(&ip->lock, "inode");
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
+  ip->ntext = 0;
+  ip->nwriter = 0;
   ip->valid = 0;
+  ip->ralast = -1;
+  ip->rawin = 0;
+  ip->goal = 0;
+  ip->dx = 0;
+  list_push_front(l, &ip->elem);
   release(&itable.lock);
 
   return ip;
@@ -287,6 +493,64 @@ idup(struct inode *ip)
   return ip;
 }
 
+// A process runs its program straight from the page cache (see
+// exec.c), so the program's file must not change under it. As in
+// Unix, a file that a process runs cannot be opened for writing,
+// and a file that is open for writing cannot be run. These
+// counts are protected by itable.lock.
+
+// Count a process running ip. Returns -1 if ip is open for
+// writing.
+int
+itextget(struct inode *ip)
+{
+  int r = -1;
+
+  acquire(&itable.lock);
+  if(ip->nwriter == 0){
+    ip->ntext++;
+    r = 0;
+  }
+  release(&itable.lock);
+  return r;
+}
+
+void
+itextput(struct inode *ip)
+{
+  acquire(&itable.lock);
+  if(ip->ntext < 1)
+    panic("itextput");
+  ip->ntext--;
+  release(&itable.lock);
+}
+
+// Count an open file that may write ip. Returns -1 if a process
+// is running ip.
+int
+iwriteget(struct inode *ip)
+{
+  int r = -1;
+
+  acquire(&itable.lock);
+  if(ip->ntext == 0){
+    ip->nwriter++;
+    r = 0;
+  }
+  release(&itable.lock);
+  return r;
+}
+
+void
+iwriteput(struct inode *ip)
+{
+  acquire(&itable.lock);
+  if(ip->nwriter < 1)
+    panic("iwriteput");
+  ip->nwriter--;
+  release(&itable.lock);
+}
+
 // Lock the given inode.
 // Reads the inode from disk if necessary.
 void
@@ -299,8 +563,10 @@ ilock(struct inode *ip)
     panic("ilock");
 
   acquiresleep(&ip->lock);
+  myproc()->nilock++;
 
   if(ip->valid == 0){
+    __sync_fetch_and_add(&itable.nread, 1);
     bp = bread(ip->dev, IBLOCK(ip->inum, sb));
     dip = (struct dinode*)bp->data + ip->inum%IPB;
     ip->type = dip->type;
@@ -323,12 +589,13 @@ iunlock(struct inode *ip)
   if(ip == 0 || !holdingsleep(&ip->lock) || ip->ref < 1)
     panic("iunlock");
 
+  myproc()->nilock--;
   releasesleep(&ip->lock);
 }
 
 // Drop a reference to an in-memory inode.
-// If that was the last reference, the inode table entry can
-// be recycled.
+// If that was the last reference, the inode table entry goes
+// on the LRU list.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -347,10 +614,15 @@ iput(struct inode *ip)
 
     release(&itable.lock);
 
+    if(ip->type == T_DIR)
+      dcpurge(ip->dev, ip->inum);
     itrunc(ip);
     ip->type = 0;
     iupdate(ip);
     ip->valid = 0;
+    acquire(&fsum.lock);
+    fsum.ifree[ip->inum / IPB]++;
+    release(&fsum.lock);
 
     releasesleep(&ip->lock);
 
@@ -358,6 +630,40 @@ iput(struct inode *ip)
   }
 
   ip->ref--;
+  if(ip->ref > 0){
+    release(&itable.lock);
+    return;
+  }
+
+  if(ip->valid){
+    list_push_front(&itable.lru, &ip->lru);
+    if(itable.nlru++ < NINODE){
+      release(&itable.lock);
+      return;
+    }
+    // Too many cached; drop the least recently used.
+    ip = list_entry(list_pop_back(&itable.lru), struct inode, lru);
+    itable.nlru--;
+    itable.nevict++;
+  }
+  list_remove(&ip->elem);
+  itable.ninode--;
+  release(&itable.lock);
+  dxdrop(ip);
+  slabfree(itable.cache, ip);
+}
+
+// Fill in the inode table section of ks.
+void
+istats(struct kstats *ks)
+{
+  acquire(&itable.lock);
+  ks->inode_nhit = itable.nhit;
+  ks->inode_nmiss = itable.nmiss;
+  ks->inode_nevict = itable.nevict;
+  ks->inode_nread = itable.nread;
+  ks->inode_n = itable.ninode;
+  ks->inode_nlru = itable.nlru;
   release(&itable.lock);
 }
 
@@ -374,60 +680,154 @@ iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT]. The NDINDIRECT blocks
+// after those are listed in the blocks listed in block
+// ip->addrs[NDIRECT+1].
 
-// Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+// Return entry i of indirect block addr, or 0 if addr is 0.
+static uint
+bentry(struct inode *ip, uint addr, uint i)
+{
+  struct buf *bp;
+
+  if(addr == 0)
+    return 0;
+  bp = bread(ip->dev, addr);
+  addr = ((uint*)bp->data)[i];
+  brelse(bp);
+  return addr;
+}
+
+// Return the disk block address of the nth block in inode ip,
+// or 0 if there is no such block.
+static uint
+blookup(struct inode *ip, uint bn)
+{
+  if(bn < NDIRECT)
+    return ip->addrs[bn];
+  bn -= NDIRECT;
+  if(bn < NINDIRECT)
+    return bentry(ip, ip->addrs[NDIRECT], bn);
+  bn -= NINDIRECT;
+  return bentry(ip, bentry(ip, ip->addrs[NDIRECT+1], bn / NINDIRECT),
+                bn % NINDIRECT);
+}
+
+// Where to allocate block bn of ip: after the block ip allocated
+// last or, if ip has not allocated one since it was read from
+// disk, right after block bn-1.
+static uint
+bgoal(struct inode *ip, uint bn)
+{
+  uint prev;
+
+  if(ip->goal)
+    return ip->goal;
+  prev = bn > 0 ? blookup(ip, bn - 1) : 0;
+  return prev ? prev + 1 : 0;
+}
+
+// Return *ap, first allocating a block for it near block bn of ip
+// if it is 0. returns 0 if out of disk space.
+static uint
+baddr(struct inode *ip, uint *ap, uint bn)
+{
+  if(*ap == 0 && (*ap = balloc(ip->dev, bgoal(ip, bn))) != 0)
+    ip->goal = *ap + 1;
+  return *ap;
+}
+
+// Return entry i of indirect block addr, first allocating a block
+// for it near block bn of ip if it is 0.
 // returns 0 if out of disk space.
 static uint
-bmap(struct inode *ip, uint bn)
+bindirect(struct inode *ip, uint addr, uint i, uint bn)
 {
-  uint addr, *a;
   struct buf *bp;
+  uint *a, goal, b;
 
-  if(bn < NDIRECT){
-    if((addr = ip->addrs[bn]) == 0){
-      addr = balloc(ip->dev);
-      if(addr == 0)
-        return 0;
-      ip->addrs[bn] = addr;
+  bp = bread(ip->dev, addr);
+  a = (uint*)bp->data;
+  if((b = a[i]) == 0){
+    // bgoal() may read this very block to find block bn-1, so
+    // let go of it first. Holding ip->lock keeps a[i] zero.
+    brelse(bp);
+    goal = bgoal(ip, bn);
+    bp = bread(ip->dev, addr);
+    a = (uint*)bp->data;
+    b = balloc(ip->dev, goal);
+    if(b){
+      a[i] = b;
+      log_write(bp);
+      ip->goal = b + 1;
     }
-    return addr;
   }
+  brelse(bp);
+  return b;
+}
+
+// Return the disk block address of the nth block in inode ip.
+// If there is no such block, bmap allocates one.
+// returns 0 if out of disk space.
+static uint
+bmap(struct inode *ip, uint bn)
+{
+  uint addr, n;
+
+  n = bn;
+  if(bn < NDIRECT)
+    return baddr(ip, &ip->addrs[bn], n);
   bn -= NDIRECT;
 
   if(bn < NINDIRECT){
     // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0){
-      addr = balloc(ip->dev);
-      if(addr == 0)
-        return 0;
-      ip->addrs[NDIRECT] = addr;
-    }
-    bp = bread(ip->dev, addr);
-    a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      addr = balloc(ip->dev);
-      if(addr){
-        a[bn] = addr;
-        log_write(bp);
-      }
-    }
-    brelse(bp);
-    return addr;
+    if((addr = baddr(ip, &ip->addrs[NDIRECT], n)) == 0)
+      return 0;
+    return bindirect(ip, addr, bn, n);
+  }
+  bn -= NINDIRECT;
+
+  if(bn < NDINDIRECT){
+    // Load the double-indirect block, then the indirect block.
+    if((addr = baddr(ip, &ip->addrs[NDIRECT+1], n)) == 0)
+      return 0;
+    if((addr = bindirect(ip, addr, bn / NINDIRECT, n)) == 0)
+      return 0;
+    return bindirect(ip, addr, bn % NINDIRECT, n);
   }
 
   panic("bmap: out of range");
 }
 
+// Free indirect block addr and the blocks it lists, which
+// are indirect blocks themselves if depth > 1.
+static void
+bfreeind(struct inode *ip, uint addr, int depth)
+{
+  struct buf *bp;
+  uint *a;
+  int j;
+
+  bp = bread(ip->dev, addr);
+  a = (uint*)bp->data;
+  for(j = 0; j < NINDIRECT; j++){
+    if(a[j] == 0)
+      continue;
+    if(depth > 1)
+      bfreeind(ip, a[j], depth - 1);
+    else
+      bfree(ip->dev, a[j]);
+  }
+  brelse(bp);
+  bfree(ip->dev, addr);
+}
+
 // Truncate inode (discard contents).
 // Caller must hold ip->lock.
 void
 itrunc(struct inode *ip)
 {
-  int i, j;
-  struct buf *bp;
-  uint *a;
+  int i;
 
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
@@ -437,21 +837,44 @@ itrunc(struct inode *ip)
   }
 
   if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
-    }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
+    bfreeind(ip, ip->addrs[NDIRECT], 1);
     ip->addrs[NDIRECT] = 0;
   }
 
+  if(ip->addrs[NDIRECT+1]){
+    bfreeind(ip, ip->addrs[NDIRECT+1], 2);
+    ip->addrs[NDIRECT+1] = 0;
+  }
+
   ip->size = 0;
+  ip->goal = 0;
+  dxdrop(ip);
+  pcpurge(ip);
   iupdate(ip);
 }
 
+// Fill in the file system section of ks.
+void
+fsstats(struct kstats *ks)
+{
+  acquire(&fsum.lock);
+  ks->fs_size = sb.size;
+  ks->fs_ninodes = sb.ninodes;
+  for(int i = 0; i < fsum.nbmap; i++)
+    ks->fs_nfree += fsum.bfree[i];
+  for(int i = 0; i < fsum.niblk; i++)
+    ks->fs_nifree += fsum.ifree[i];
+  ks->fs_nballoc = fsum.nballoc;
+  ks->fs_nbscan = fsum.nbscan;
+  ks->fs_nialloc = fsum.nialloc;
+  ks->fs_niscan = fsum.niscan;
+  ks->fs_nnamei = fsum.nnamei;
+  ks->fs_nameitime = fsum.nameitime;
+  ks->fs_ndxbuild = fsum.ndxbuild;
+  ks->fs_ndxprobe = fsum.ndxprobe;
+  release(&fsum.lock);
+}
+
 // Copy stat information from inode.
 // Caller must hold ip->lock.
 void
@@ -464,6 +887,76 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Read ahead for a sequential reader. Reading block bn right after
+// block bn-1 starts asynchronous reads of the blocks up to bn plus
+// the window; any other jump closes the window. The window starts
+// at RAMIN blocks and doubles, up to RAMAX, each time the reader
+// gets within half a window of the blocks already started.
+// Caller must hold ip->lock.
+#define RAMIN 4
+#define RAMAX 32
+
+static void
+ireadahead(struct inode *ip, uint bn)
+{
+  uint addrs[RAMAX], last;
+  int n;
+
+  if(bn == ip->ralast)
+    return;
+  if(bn != ip->ralast + 1){
+    ip->ralast = bn;
+    ip->rawin = 0;
+    return;
+  }
+  ip->ralast = bn;
+
+  if(ip->rawin == 0){
+    ip->rawin = RAMIN;
+    ip->ranext = bn + 1;
+  } else if(ip->ranext > bn + ip->rawin / 2){
+    return;
+  } else if(ip->rawin < RAMAX){
+    ip->rawin *= 2;
+  }
+
+  if(ip->size == 0)
+    return;
+  last = (ip->size - 1) / BSIZE;
+  if(ip->ranext <= bn)
+    ip->ranext = bn + 1;
+  for(n = 0; ip->ranext <= bn + ip->rawin && ip->ranext <= last; ip->ranext++){
+    if((addrs[n] = bmap(ip, ip->ranext)) == 0)
+      break;
+    n++;
+  }
+  breadahead(ip->dev, addrs, n);
+}
+
+// Read pages pgno up to pgno+n-1 of ip into mem[], with zeros
+// past the end of the file, for the page cache. The blocks are
+// not added to the buffer cache. Caller must hold ip->lock.
+void
+ireadpages(struct inode *ip, uint pgno, int n, char **mem)
+{
+  uint blocknos[NPCRA*(PGSIZE/BSIZE)], bn;
+  uchar *dst[NPCRA*(PGSIZE/BSIZE)];
+  int nb = 0;
+
+  if(n > NPCRA)
+    panic("ireadpages");
+  for(int i = 0; i < n; i++){
+    memset(mem[i], 0, PGSIZE);
+    for(int k = 0; k < PGSIZE/BSIZE; k++){
+      bn = (pgno + i) * (PGSIZE/BSIZE) + k;
+      if(bn * BSIZE >= ip->size || (blocknos[nb] = bmap(ip, bn)) == 0)
+        break;
+      dst[nb++] = (uchar*)mem[i] + k*BSIZE;
+    }
+  }
+  breadnc(ip->dev, blocknos, nb, dst);
+}
+
 // Read data from inode.
 // Caller must hold ip->lock.
 // If user_dst==1, then dst is a user virtual address;
@@ -473,16 +966,36 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 {
   uint tot, m;
   struct buf *bp;
+  char *data;
+  int r;
 
   if(off > ip->size || off + n < off)
     return 0;
   if(off + n > ip->size)
     n = ip->size - off;
 
+  // File data comes from the page cache, which leaves the
+  // buffer cache to directories and other metadata.
+  if(ip->type == T_FILE){
+    for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
+      if((data = pcget(ip, off/PGSIZE)) == 0)
+        break;
+      m = min(n - tot, PGSIZE - off%PGSIZE);
+      r = either_copyout(user_dst, dst, data + (off % PGSIZE), m);
+      kfree(data);
+      if(r == -1){
+        tot = -1;
+        break;
+      }
+    }
+    return tot;
+  }
+
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
     uint addr = bmap(ip, off/BSIZE);
     if(addr == 0)
       break;
+    ireadahead(ip, off/BSIZE);
     bp = bread(ip->dev, addr);
     m = min(n - tot, BSIZE - off%BSIZE);
     if(either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1) {
@@ -524,7 +1037,12 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
       break;
     }
     log_write(bp);
-    brelse(bp);
+    if(ip->type == T_FILE){
+      pcupdate(ip, off, (char*)bp->data + (off % BSIZE), m);
+      brelsedata(bp);
+    } else {
+      brelse(bp);
+    }
   }
 
   if(off > ip->size)
@@ -546,16 +1064,142 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
-// Look for a directory entry in a directory.
-// If found, set *poff to byte offset of entry.
-struct inode*
-dirlookup(struct inode *dp, char *name, uint *poff)
+// Directory index.
+//
+// A directory is a flat array of dirents, which is what ls reads.
+// A directory of DXMIN or more blocks also gets an index in
+// memory, built by one pass over the directory the first time it
+// is searched and kept up to date for as long as the inode stays
+// in the inode table. The index is an open-addressing hash table
+// from a name's hash to its dirent, so lookups, inserts and
+// removes read one dirent instead of the whole directory. It is
+// allocated with kalloc_order(); the table follows the header.
+// Caller must hold dp->lock for all of these.
+
+#define DXMIN 2                    // blocks before a directory is indexed
+#define DXIDX 22                   // bits of dirent number in an entry
+#define DXIDXMASK ((1 << DXIDX) - 1)
+#define DXTOMB 0xffffffff          // entry of a removed name
+
+struct dirindex {
+  int order;    // the index is 2^order pages
+  uint mask;    // table entries - 1
+  uint n;       // live entries
+  uint ntomb;   // removed entries
+  uint free;    // no free dirent before this offset
+  uint ent[];   // 0, DXTOMB, or hash tag | (dirent number + 1)
+};
+
+static uint
+dxhash(char *name)
 {
-  uint off, inum;
-  struct dirent de;
+  uint h = 2166136261;
 
-  if(dp->type != T_DIR)
-    panic("dirlookup not DIR");
+  for(int i = 0; i < DIRSIZ && name[i]; i++)
+    h = (h ^ (uchar)name[i]) * 16777619;
+  return h;
+}
+
+// Add the dirent at off, whose name hashes to h, to dx.
+static void
+dxadd(struct dirindex *dx, uint h, uint off)
+{
+  uint i;
+
+  for(i = h & dx->mask; dx->ent[i] != 0 && dx->ent[i] != DXTOMB; i = (i + 1) & dx->mask)
+    ;
+  if(dx->ent[i] == DXTOMB)
+    dx->ntomb--;
+  dx->ent[i] = (h & ~DXIDXMASK) | (off / sizeof(struct dirent) + 1);
+  dx->n++;
+}
+
+// Free dp's index, if it has one.
+static void
+dxdrop(struct inode *dp)
+{
+  if(dp->dx){
+    kfree_order(dp->dx, dp->dx->order);
+    dp->dx = 0;
+  }
+}
+
+// Return dp's index, building it if dp is large enough to
+// have one. Returns 0 if dp has no index and memory is short.
+static struct dirindex*
+dxget(struct inode *dp)
+{
+  struct dirindex *dx;
+  struct dirent *de;
+  struct buf *bp;
+  uint n, nent, off, addr;
+  int order;
+
+  if(dp->dx || dp->size < DXMIN * BSIZE)
+    return dp->dx;
+  n = dp->size / sizeof(struct dirent);
+  if(n >= DXIDXMASK - 1)
+    return 0;  // too big to number
+
+  // Keep the table at most half full, with room to grow.
+  for(nent = 256; nent < 2 * n + 128; nent *= 2)
+    ;
+  for(order = 0; (PGSIZE << order) < sizeof(*dx) + nent * sizeof(uint); order++)
+    ;
+  if(order > MAXORDER || (dx = kalloc_order(order)) == 0)
+    return 0;
+  memset(dx, 0, sizeof(*dx) + nent * sizeof(uint));
+  dx->order = order;
+  dx->mask = nent - 1;
+  dx->free = dp->size;
+
+  for(off = 0; off < dp->size; off += BSIZE){
+    if((addr = bmap(dp, off / BSIZE)) == 0)
+      panic("dxget: bmap");
+    bp = bread(dp->dev, addr);
+    for(de = (struct dirent*)bp->data; de < (struct dirent*)(bp->data + BSIZE); de++){
+      n = off + ((uchar*)de - bp->data);
+      if(n >= dp->size)
+        break;
+      if(de->inum == 0){
+        if(n < dx->free)
+          dx->free = n;
+        continue;
+      }
+      dxadd(dx, dxhash(de->name), n);
+    }
+    brelse(bp);
+  }
+  dp->dx = dx;
+  __sync_fetch_and_add(&fsum.ndxbuild, 1);
+  return dx;
+}
+
+// Look for name in directory dp. If found, set *poff to the byte
+// offset of its entry and return its inum; otherwise return 0.
+static uint
+dirfind(struct inode *dp, char *name, uint *poff)
+{
+  struct dirindex *dx;
+  struct dirent de;
+  uint off, h, i, e;
+
+  if((dx = dxget(dp)) != 0){
+    h = dxhash(name);
+    for(i = h & dx->mask; (e = dx->ent[i]) != 0; i = (i + 1) & dx->mask){
+      if(e == DXTOMB || (e & ~DXIDXMASK) != (h & ~DXIDXMASK))
+        continue;
+      off = ((e & DXIDXMASK) - 1) * sizeof(de);
+      if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+        panic("dirfind read");
+      __sync_fetch_and_add(&fsum.ndxprobe, 1);
+      if(de.inum != 0 && namecmp(name, de.name) == 0){
+        *poff = off;
+        return de.inum;
+      }
+    }
+    return 0;
+  }
 
   for(off = 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
@@ -564,16 +1208,34 @@ dirlookup(struct inode *dp, char *name, uint *poff)
       continue;
     if(namecmp(name, de.name) == 0){
       // entry matches path element
-      if(poff)
-        *poff = off;
-      inum = de.inum;
-      return iget(dp->dev, inum);
+      *poff = off;
+      return de.inum;
     }
   }
-
   return 0;
 }
 
+// Look for a directory entry in a directory.
+// If found, set *poff to byte offset of entry.
+struct inode*
+dirlookup(struct inode *dp, char *name, uint *poff)
+{
+  uint off, inum;
+
+  if(dp->type != T_DIR)
+    panic("dirlookup not DIR");
+
+  if(dclookup(dp->dev, dp->inum, name, &inum, &off) == 0){
+    inum = dirfind(dp, name, &off);
+    dcenter(dp->dev, dp->inum, name, inum, off);
+  }
+  if(inum == 0)
+    return 0;
+  if(poff)
+    *poff = off;
+  return iget(dp->dev, inum);
+}
+
 // Write a new directory entry (name, inum) into the directory dp.
 // Returns 0 on success, -1 on failure (e.g. out of disk blocks).
 int
@@ -590,7 +1252,7 @@ dirlink(struct inode *dp, char *name, uint inum)
   }
 
   // Look for an empty dirent.
-  for(off = 0; off < dp->size; off += sizeof(de)){
+  for(off = dp->dx ? dp->dx->free : 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
       panic("dirlink read");
     if(de.inum == 0)
@@ -599,12 +1261,55 @@ dirlink(struct inode *dp, char *name, uint inum)
 
   strncpy(de.name, name, DIRSIZ);
   de.inum = inum;
-  if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+  if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de)){
+    dcremove(dp->dev, dp->inum, name);
     return -1;
+  }
+  dcenter(dp->dev, dp->inum, name, inum, off);
+
+  if(dp->dx){
+    dp->dx->free = off + sizeof(de);
+    if((dp->dx->n + dp->dx->ntomb + 1) * 4 > (dp->dx->mask + 1) * 3 ||
+       off / sizeof(de) + 1 >= DXIDXMASK - 1){
+      // Too full; build a bigger one, which will have this entry.
+      dxdrop(dp);
+      dxget(dp);
+    } else {
+      dxadd(dp->dx, dxhash(name), off);
+    }
+  }
 
   return 0;
 }
 
+// Remove the entry for name, at offset off, from directory dp.
+void
+dirunlink(struct inode *dp, char *name, uint off)
+{
+  struct dirindex *dx = dp->dx;
+  struct dirent de;
+  uint i, h, e;
+
+  memset(&de, 0, sizeof(de));
+  if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+    panic("unlink: writei");
+  dcenter(dp->dev, dp->inum, name, 0, 0);
+
+  if(dx){
+    h = dxhash(name);
+    for(i = h & dx->mask; (e = dx->ent[i]) != 0; i = (i + 1) & dx->mask){
+      if(e != DXTOMB && (e & DXIDXMASK) == off / sizeof(de) + 1){
+        dx->ent[i] = DXTOMB;
+        dx->n--;
+        dx->ntomb++;
+        break;
+      }
+    }
+    if(off < dx->free)
+      dx->free = off;
+  }
+}
+
 // Paths
 
 // Copy the next path element from path into name.
@@ -683,15 +1388,29 @@ namex(char *path, int nameiparent, char *name)
   return ip;
 }
 
+// namex() and count the lookup and the time it took.
+static struct inode*
+nametime(char *path, int nameiparent, char *name)
+{
+  struct inode *ip;
+  uint64 start;
+
+  start = r_time();
+  ip = namex(path, nameiparent, name);
+  __sync_fetch_and_add(&fsum.nnamei, 1);
+  __sync_fetch_and_add(&fsum.nameitime, r_time() - start);
+  return ip;
+}
+
 struct inode*
 namei(char *path)
 {
   char name[DIRSIZ];
-  return namex(path, 0, name);
+  return nametime(path, 0, name);
 }
 
 struct inode*
 nameiparent(char *path, char *name)
 {
-  return namex(path, 1, name);
+  return nametime(path, 1, name);
 }
@@ -22,11 +22,14 @@ struct superblock {
   uint bmapstart;    // Block number of first free map block
 };
 
-#define FSMAGIC 0x10203040
+// Changed from 0x10203040 when inodes gained a double-indirect
+// block, so fsinit() refuses images in the old layout.
+#define FSMAGIC 0x10203041
 
-#define NDIRECT 12
+#define NDIRECT 11
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT + NDINDIRECT)
 
 // On-disk inode structure
 struct dinode {
@@ -35,7 +38,7 @@ struct dinode {
   short minor;          // Minor device number (T_DEVICE only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint addrs[NDIRECT+2];   // Data block addresses: direct, indirect, double indirect
 };
 
 // Inodes per block.
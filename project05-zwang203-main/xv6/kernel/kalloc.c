@@ -7,7 +7,9 @@
 #include "memlayout.h"
 #include "spinlock.h"
 #include "riscv.h"
+#include "list.h"
 #include "defs.h"
+#include "kstats.h"
 
 void freerange(void *pa_start, void *pa_end);
 
@@ -18,15 +20,65 @@ struct run {
   struct run *next;
 };
 
+// The global pool is a binary buddy allocator over the pages
+// between end and PHYSTOP. free[k] lists the free blocks of 2^k
+// pages, and pgorder[i] is k+1 if page i heads a free block of
+// order k, or 0 otherwise. Pages are numbered from KERNBASE, not
+// from end, so a block of 2^k pages is physically aligned to its
+// size. The kernel's own pages are never free, so nothing merges
+// with them.
+struct block {
+  struct list_elem elem;
+};
+
 struct {
   struct spinlock lock;
-  struct run *freelist;
+  uint64 base;  // Address of page 0
+  int npages;
+  struct list free[MAXORDER+1];
+  int nfree;    // Number of pages in free blocks
+  uint64 nrefill;
+  uint64 ndrain;
 } kmem;
 
+char pgorder[(PHYSTOP - KERNBASE) / PGSIZE];
+
+#define PA2PG(pa) (((uint64)(pa) - kmem.base) / PGSIZE)
+#define PG2PA(i) (kmem.base + (uint64)(i) * PGSIZE)
+
+// Each hart keeps a small cache of free pages in front of kmem, so
+// that most kalloc()/kfree() calls take only the hart's own lock.
+// A cache refills from and drains to kmem KBATCH pages at a time,
+// and steals half of another hart's cache when kmem is empty.
+// The lock is needed only because of stealing.
+#define KBATCH 32
+#define KCACHEMAX (2 * KBATCH)
+
+struct kcache {
+  struct spinlock lock;
+  struct run *freelist;
+  int n;        // Number of pages on freelist
+  uint64 nalloc;
+  uint64 nsteal;
+} kcache[NCPU];
+
+// Reference counts of allocated pages. A page is shared by
+// several page tables after a copy-on-write fork, and goes back
+// on the free list only when the last reference is dropped.
+// Updated with atomic instructions rather than under a lock.
+#define PA2REF(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+int pageref[(PHYSTOP - KERNBASE) / PGSIZE];
+
 void
 kinit()
 {
   initlock(&kmem.lock, "kmem");
+  kmem.base = KERNBASE;
+  kmem.npages = (PHYSTOP - kmem.base) / PGSIZE;
+  for(int k = 0; k <= MAXORDER; k++)
+    list_init(&kmem.free[k]);
+  for(int i = 0; i < NCPU; i++)
+    initlock(&kcache[i].lock, "kcache");
   freerange(end, (void*)PHYSTOP);
 }
 
@@ -35,31 +87,314 @@ freerange(void *pa_start, void *pa_end)
 {
   char *p;
   p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
+  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE){
+    pageref[PA2REF(p)] = 1;
     kfree(p);
+  }
 }
 
-// Free the page of physical memory pointed at by pa,
-// which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// Take a free block of 2^order pages, splitting a larger one
+// if needed. Caller must hold kmem.lock.
+static void *
+bd_alloc(int order)
+{
+  struct block *b;
+  int k;
+
+  for(k = order; k <= MAXORDER && list_empty(&kmem.free[k]); k++)
+    ;
+  if(k > MAXORDER)
+    return 0;
+
+  b = list_entry(list_pop_front(&kmem.free[k]), struct block, elem);
+  pgorder[PA2PG(b)] = 0;
+  while(k > order){
+    // Put the upper half back as a free block.
+    struct block *h;
+
+    k--;
+    h = (struct block*)((char*)b + (PGSIZE << k));
+    pgorder[PA2PG(h)] = k + 1;
+    list_push_front(&kmem.free[k], &h->elem);
+  }
+  kmem.nfree -= 1 << order;
+  return b;
+}
+
+// Return a block of 2^order pages, merging it with its buddy for
+// as long as the buddy is free too. Caller must hold kmem.lock.
+static void
+bd_free(void *pa, int order)
+{
+  struct block *b;
+  int i, bi;
+
+  kmem.nfree += 1 << order;
+  i = PA2PG(pa);
+  while(order < MAXORDER){
+    bi = i ^ (1 << order);
+    if(bi + (1 << order) > kmem.npages || pgorder[bi] != order + 1)
+      break;
+    b = (struct block*)PG2PA(bi);
+    list_remove(&b->elem);
+    pgorder[bi] = 0;
+    i &= ~(1 << order);
+    order++;
+  }
+  b = (struct block*)PG2PA(i);
+  pgorder[i] = order + 1;
+  list_push_front(&kmem.free[order], &b->elem);
+}
+
+// Drop a reference to the page of physical memory pointed at
+// by pa, which normally should have been returned by a
+// call to kalloc(), and free it if that was the last one.
+// (The exception is when initializing the allocator; see
+// kinit above.)
 void
 kfree(void *pa)
 {
-  struct run *r;
+  struct run *r, *head, *tail;
+  struct kcache *kc;
+  int n;
 
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+  n = __sync_sub_and_fetch(&pageref[PA2REF(pa)], 1);
+  if(n < 0)
+    panic("kfree: ref");
+  if(n > 0)
+    return;
+
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
 
   r = (struct run*)pa;
+  head = 0;
+
+  push_off();
+  kc = &kcache[cpuid()];
+  acquire(&kc->lock);
+  r->next = kc->freelist;
+  kc->freelist = r;
+  kc->n += 1;
+  if(kc->n > KCACHEMAX){
+    // Hand a batch back to kmem.
+    head = tail = kc->freelist;
+    for(int i = 1; i < KBATCH; i++)
+      tail = tail->next;
+    kc->freelist = tail->next;
+    kc->n -= KBATCH;
+  }
+  release(&kc->lock);
+
+  if(head){
+    tail->next = 0;
+    acquire(&kmem.lock);
+    for(r = head; r; r = head){
+      head = r->next;
+      bd_free(r, 0);
+    }
+    kmem.ndrain += 1;
+    release(&kmem.lock);
+  }
+  pop_off();
+}
+
+// Take up to KBATCH pages from the buddy lists or, failing that, half of
+// another hart's cache. Keep one for the caller and put the rest
+// in kc. Returns 0 if there is no free memory anywhere.
+static struct run *
+krefill(struct kcache *kc)
+{
+  struct kcache *v;
+  struct run *head, *tail, *r;
+  int n, stolen;
+
+  head = tail = 0;
+  n = stolen = 0;
 
   acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
+  while(n < KBATCH && (r = bd_alloc(0)) != 0){
+    r->next = head;
+    if(head == 0)
+      tail = r;
+    head = r;
+    n++;
+  }
+  if(n > 0)
+    kmem.nrefill += 1;
   release(&kmem.lock);
+
+  // Never hold two cache locks at once, so that harts stealing
+  // from each other cannot deadlock.
+  for(v = kcache; n == 0 && v < &kcache[NCPU]; v++){
+    if(v == kc || v->n == 0)
+      continue;
+    acquire(&v->lock);
+    if(v->n > 0){
+      stolen = 1;
+      n = (v->n + 1) / 2;
+      head = tail = v->freelist;
+      for(int i = 1; i < n; i++)
+        tail = tail->next;
+      v->freelist = tail->next;
+      v->n -= n;
+    }
+    release(&v->lock);
+  }
+
+  if(n == 0)
+    return 0;
+
+  r = head;
+  head = head->next;
+  n--;
+
+  acquire(&kc->lock);
+  if(stolen)
+    kc->nsteal += 1;
+  if(n > 0){
+    tail->next = kc->freelist;
+    kc->freelist = head;
+    kc->n += n;
+  }
+  release(&kc->lock);
+  return r;
+}
+
+// Give every page in the per-hart caches back to the buddy
+// lists, so that they can coalesce.
+static void
+kdrainall(void)
+{
+  struct kcache *kc;
+  struct run *r, *head;
+
+  for(kc = kcache; kc < &kcache[NCPU]; kc++){
+    acquire(&kc->lock);
+    head = kc->freelist;
+    kc->freelist = 0;
+    kc->n = 0;
+    release(&kc->lock);
+
+    acquire(&kmem.lock);
+    for(r = head; r; r = head){
+      head = r->next;
+      bd_free(r, 0);
+    }
+    release(&kmem.lock);
+  }
+}
+
+// Allocate 2^order physically contiguous pages, aligned to their
+// size. kalloc() is the order 0 case. Returns 0 if there is no
+// free block that large.
+void *
+kalloc_order(int order)
+{
+  void *pa;
+
+  if(order == 0)
+    return kalloc();
+  if(order < 0 || order > MAXORDER)
+    return 0;
+
+  acquire(&kmem.lock);
+  pa = bd_alloc(order);
+  release(&kmem.lock);
+  if(pa == 0){
+    kdrainall();
+    acquire(&kmem.lock);
+    pa = bd_alloc(order);
+    release(&kmem.lock);
+  }
+
+  if(pa){
+    pageref[PA2REF(pa)] = 1;
+    memset(pa, 5, PGSIZE << order); // fill with junk
+  }
+  return pa;
+}
+
+// Free a block returned by kalloc_order(order).
+void
+kfree_order(void *pa, int order)
+{
+  int n;
+
+  if(order == 0){
+    kfree(pa);
+    return;
+  }
+  if(order < 0 || order > MAXORDER ||
+     (uint64)pa % (PGSIZE << order) != 0 ||
+     (char*)pa < end || (uint64)pa + (PGSIZE << order) > PHYSTOP)
+    panic("kfree_order");
+
+  n = __sync_sub_and_fetch(&pageref[PA2REF(pa)], 1);
+  if(n < 0)
+    panic("kfree_order: ref");
+  if(n > 0)
+    return;
+
+  // Fill with junk to catch dangling refs.
+  memset(pa, 1, PGSIZE << order);
+
+  acquire(&kmem.lock);
+  bd_free(pa, order);
+  release(&kmem.lock);
+}
+
+// Add a reference to an allocated page.
+void
+kref(void *pa)
+{
+  if(__sync_fetch_and_add(&pageref[PA2REF(pa)], 1) < 1)
+    panic("kref");
+}
+
+// Return the number of references to an allocated page.
+int
+krefcnt(void *pa)
+{
+  return __atomic_load_n(&pageref[PA2REF(pa)], __ATOMIC_RELAXED);
+}
+
+// Return the number of free pages, counting those in the
+// per-hart caches.
+int
+kpages(void)
+{
+  int n = kmem.nfree;
+
+  for(int i = 0; i < NCPU; i++)
+    n += kcache[i].n;
+  return n;
+}
+
+// Take a page from this hart's cache, refilling it if empty.
+static struct run *
+kget(void)
+{
+  struct kcache *kc;
+  struct run *r;
+
+  push_off();
+  kc = &kcache[cpuid()];
+  acquire(&kc->lock);
+  r = kc->freelist;
+  if(r){
+    kc->freelist = r->next;
+    kc->n -= 1;
+  }
+  kc->nalloc += 1;
+  release(&kc->lock);
+  if(r == 0)
+    r = krefill(kc);
+  pop_off();
+  return r;
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -70,13 +405,33 @@ kalloc(void)
 {
   struct run *r;
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  release(&kmem.lock);
+  // Out of pages: shrink the buffer and page caches and try again.
+  if((r = kget()) == 0 && breclaim() + pcreclaim() > 0)
+    r = kget();
 
-  if(r)
+  if(r){
+    pageref[PA2REF(r)] = 1;
     memset((char*)r, 5, PGSIZE); // fill with junk
+  }
   return (void*)r;
 }
+
+// Fill in the page allocator section of ks.
+void
+kallocstats(struct kstats *ks)
+{
+  for(int i = 0; i < NCPU; i++){
+    ks->kalloc_nalloc += kcache[i].nalloc;
+    ks->kalloc_nsteal += kcache[i].nsteal;
+  }
+  for(int i = 0; i < NCPU; i++)
+    ks->kalloc_ncached += kcache[i].n;
+  acquire(&kmem.lock);
+  for(int k = 0; k <= MAXORDER; k++)
+    ks->kalloc_nblock[k] = list_size(&kmem.free[k]);
+  release(&kmem.lock);
+  ks->kalloc_nrefill = kmem.nrefill;
+  ks->kalloc_ndrain = kmem.ndrain;
+  ks->kmem_nacquire = kmem.lock.nacquire;
+  ks->kmem_ncontend = kmem.lock.ncontend;
+}
@@ -0,0 +1,95 @@
+// Kernel statistics, copied out by the kstats() system call.
+// Include param.h first.
+
+#define NQDEPTH 16  // queue depth histogram buckets; the last is "or more"
+struct kstats {
+  // sys_sleep() timer wheel
+  uint64 timer_fired;      // Sleep deadlines that expired
+  uint64 timer_avoided;    // Per-tick wakeups of sleepers not yet due
+  uint64 timer_lat_sum;    // Total ticks from deadline to sleeper running
+  uint64 timer_lat_max;    // Largest single deadline-to-running delay
+
+  // kalloc() per-hart page caches
+  uint64 kalloc_nalloc;    // Calls to kalloc()
+  uint64 kalloc_nrefill;   // Batches a hart took from the global free list
+  uint64 kalloc_ndrain;    // Batches a hart gave back to the global free list
+  uint64 kalloc_nsteal;    // Batches a hart took from another hart's cache
+  uint64 kmem_nacquire;    // Acquisitions of the global kmem.lock
+  uint64 kmem_ncontend;    // ... that had to spin
+  uint64 kalloc_ncached;   // Free pages held in per-hart caches
+  uint64 kalloc_nblock[MAXORDER+1]; // Free blocks of 2^k pages
+
+  // Buffer cache
+  uint64 bcache_nhit;      // bget() found the block cached
+  uint64 bcache_nmiss;     // bget() did not find the block cached
+  uint64 bcache_nevict;    // Misses that recycled a buffer with valid data
+  uint64 bcache_ngrow;     // Misses that added a buffer
+  uint64 bcache_nshrink;   // Buffers freed under memory pressure
+  uint64 bcache_nbuf;      // Buffers now in the cache
+  uint64 bcache_nra;       // Blocks read ahead
+  uint64 bcache_nrahit;    // ... that a later bread() found
+  uint64 bcache_nacquire;  // Acquisitions of the bcache locks
+  uint64 bcache_ncontend;  // ... that had to spin
+
+  // File system log
+  uint64 log_size;         // Data blocks in the log
+  uint64 log_nop;          // FS system calls (begin_op/end_op pairs)
+  uint64 log_ncommit;      // Transactions committed
+  uint64 log_nblocks;      // Blocks in those transactions
+  uint64 log_nticks;       // Ticks spent committing
+  uint64 log_nckpt;        // Checkpoints
+  uint64 log_nckptblocks;  // Blocks installed by them
+
+  // File system allocators
+  uint64 fs_size;          // Blocks in the file system
+  uint64 fs_nfree;         // ... that are free
+  uint64 fs_ninodes;       // Inodes
+  uint64 fs_nifree;        // ... that are free
+  uint64 fs_nballoc;       // balloc() calls
+  uint64 fs_nbscan;        // Bitmap blocks they read
+  uint64 fs_nialloc;       // ialloc() calls
+  uint64 fs_niscan;        // Inode blocks they read
+  uint64 fs_nnamei;        // Path lookups
+  uint64 fs_nameitime;     // Timer cycles spent in them
+  uint64 fs_ndxbuild;      // Directory indexes built
+  uint64 fs_ndxprobe;      // Dirents read by indexed lookups
+
+  // In-memory inode table
+  uint64 inode_nhit;       // iget()s that found the inode in the table
+  uint64 inode_nmiss;      // ... that had to add it
+  uint64 inode_nevict;     // Unreferenced inodes dropped
+  uint64 inode_nread;      // ilock()s that read the disk
+  uint64 inode_n;          // Inodes in the table
+  uint64 inode_nlru;       // ... of them unreferenced
+
+  // Page cache
+  uint64 pc_nhit;          // pcget()s that found the page cached
+  uint64 pc_nmiss;         // ... that read it
+  uint64 pc_nra;           // Pages read ahead with them
+  uint64 pc_nevict;        // Pages dropped
+  uint64 pc_npage;         // Pages in the cache
+  uint64 mmap_nfault;      // Page faults on mmap()ed files
+  uint64 exec_nshared;     // Program pages exec() mapped from the page cache
+  uint64 exec_ncopied;     // ... that it copied or zeroed instead
+
+  // Directory entry cache
+  uint64 dc_nhit;          // Lookups that found a name
+  uint64 dc_nneg;          // ... that found a name is absent
+  uint64 dc_nmiss;         // ... that had to read the directory
+  uint64 dc_nevict;        // Entries recycled
+
+  // virtio disk
+  uint64 disk_nreq;        // Requests submitted
+  uint64 disk_nblocks;     // Blocks in those requests
+  uint64 disk_nwrite;      // ... that were written
+  uint64 disk_qdepth[NQDEPTH]; // Requests submitted with i+1 in flight
+
+  // Slab caches; unused entries have an empty name
+  struct {
+    char name[16];
+    uint64 size;           // Object size in bytes
+    uint64 nslab;          // Pages held by the cache
+    uint64 ninuse;         // Objects allocated
+    uint64 ncached;        // Free objects in per-hart magazines
+  } slab[NSLAB];
+};
@@ -6,12 +6,13 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "kstats.h"
 
 // Simple logging that allows concurrent FS system calls.
 //
 // A log transaction contains the updates of multiple FS system
-// calls. The logging system only commits when there are
-// no FS system calls active. Thus there is never
+// calls. The logging system only seals a transaction when there
+// are no FS system calls active in it. Thus there is never
 // any reasoning required about whether a commit might
 // write an uncommitted system call's updates to disk.
 //
@@ -19,7 +20,25 @@
 // its start and end. Usually begin_op() just increments
 // the count of in-progress FS system calls and returns.
 // But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// sleeps until the open transaction has been sealed.
+// Each call reserves MAXOPBLOCKS blocks of log space; a call
+// that writes more, like a large write(), reserves what it
+// needs with begin_opn()/end_opn() instead.
+//
+// The log is pipelined. Sealing a transaction copies its blocks
+// out of the buffer cache into log.copy[]; from then on FS system
+// calls fill the next open transaction while the sealed one is
+// written to the log and committed from the copies. Every FS
+// system call that ends while a commit is in progress joins the
+// next transaction, and the committer commits it as soon as the
+// previous one is, so concurrent calls are committed as a group.
+//
+// Committed blocks are not installed right away. They stay in the
+// log, and their cache blocks stay pinned, until there is no room
+// for the next transaction. Then the log flusher, a kernel thread,
+// installs the newest copy of each block and empties the log, so a
+// block that many transactions rewrite, like a bitmap or inode
+// block, goes to its home location once.
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
@@ -28,55 +47,92 @@
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// Each commit appends its blocks and rewrites the header. A block
+// may appear more than once; recovery installs in log order, so
+// the last copy wins.
+// The number of log blocks comes from the superblock, up to
+// as many as fit in the header block.
+// Log appends are synchronous, but commit() starts every block
+// write of a phase before waiting for any of them.
+
+// Most data blocks a log can have: as many as the header block
+// has room for.
+#define LOGMAX (BSIZE / sizeof(int) - 1)
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
 struct logheader {
   int n;
-  int block[LOGSIZE];
+  int block[LOGMAX];
 };
 
 struct log {
   struct spinlock lock;
   int start;
-  int size;
+  int size;        // data blocks in the log
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int reserved;    // log blocks reserved by them.
+  int committing;  // some process is in commit().
+  int sealing;     // commit() is copying the open transaction, please wait.
+  int flushing;    // the flusher is installing the log.
   int dev;
-  struct logheader lh;
+  struct logheader lh;      // the open transaction
+  struct logheader clh;     // the committed blocks in the log
+  struct buf *home[LOGMAX]; // pinned cache buffers of clh's blocks
+  struct buf *copy[LOGMAX]; // clh's blocks as committed
+  struct buf *inst[LOGMAX]; // install_trans() scratch
+
+  uint64 nop;      // FS sys calls
+  uint64 ncommit;  // transactions committed
+  uint64 nblocks;  // blocks in those transactions
+  uint64 nticks;   // ticks spent in commit()
+  uint64 nckpt;    // checkpoints by the flusher
+  uint64 nckptblocks; // blocks installed by them
 };
 struct log log;
 
 static void recover_from_log(void);
 static void commit();
+static void logflusher(void);
 
 void
 initlog(int dev, struct superblock *sb)
 {
-  if (sizeof(struct logheader) >= BSIZE)
+  struct slabcache *cache;
+
+  if (sizeof(struct logheader) > BSIZE)
     panic("initlog: too big logheader");
+  if (sb->nlog < MAXOPBLOCKS + 1)
+    panic("initlog: log too small");
 
   initlock(&log.lock, "log");
   log.start = sb->logstart;
-  log.size = sb->nlog;
+  log.size = sb->nlog - 1;
+  if (log.size > LOGMAX)
+    log.size = LOGMAX;  // the rest of the log goes unused
   log.dev = dev;
+
+  cache = slabcreate("logbuf", sizeof(struct buf));
+  for (int i = 0; i < log.size; i++) {
+    if ((log.copy[i] = slaballoc(cache)) == 0)
+      panic("initlog: copy");
+    initsleeplock(&log.copy[i]->lock, "log copy");
+  }
   recover_from_log();
+  kthread("logflush", logflusher);
 }
 
 // Copy committed blocks from log to their home location
 static void
-install_trans(int recovering)
+install_from_log(void)
 {
   int tail;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
+  for (tail = 0; tail < log.clh.n; tail++) {
     struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
+    struct buf *dbuf = bread(log.dev, log.clh.block[tail]); // read dst
     memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
     bwrite(dbuf);  // write dst to disk
-    if(recovering == 0)
-      bunpin(dbuf);
     brelse(lbuf);
     brelse(dbuf);
   }
@@ -89,14 +145,14 @@ read_head(void)
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *lh = (struct logheader *) (buf->data);
   int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
+  log.clh.n = lh->n;
+  for (i = 0; i < log.clh.n; i++) {
+    log.clh.block[i] = lh->block[i];
   }
   brelse(buf);
 }
 
-// Write in-memory log header to disk.
+// Write the header of the committed blocks to disk.
 // This is the true point at which the
 // current transaction commits.
 static void
@@ -105,9 +161,9 @@ write_head(void)
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *hb = (struct logheader *) (buf->data);
   int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+  hb->n = log.clh.n;
+  for (i = 0; i < log.clh.n; i++) {
+    hb->block[i] = log.clh.block[i];
   }
   bwrite(buf);
   brelse(buf);
@@ -117,42 +173,63 @@ static void
 recover_from_log(void)
 {
   read_head();
-  install_trans(1); // if committed, copy from log to disk
-  log.lh.n = 0;
+  install_from_log(); // if committed, copy from log to disk
+  log.clh.n = 0;
   write_head(); // clear the log
 }
 
-// called at the start of each FS system call.
+// Return the most blocks one FS system call may reserve.
+int
+log_opmax(void)
+{
+  return log.size;
+}
+
+// called at the start of each FS system call that writes
+// at most nblocks blocks.
 void
-begin_op(void)
+begin_opn(int nblocks)
 {
+  if(nblocks < 1 || nblocks > log.size)
+    panic("begin_opn");
+
   acquire(&log.lock);
   while(1){
-    if(log.committing){
+    if(log.sealing){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+    } else if(log.lh.n + log.reserved + nblocks > log.size){
       // this op might exhaust log space; wait for commit.
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
+      log.reserved += nblocks;
+      log.nop += 1;
       release(&log.lock);
       break;
     }
   }
 }
 
-// called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// called at the start of each FS system call.
 void
-end_op(void)
+begin_op(void)
+{
+  begin_opn(MAXOPBLOCKS);
+}
+
+// called at the end of each FS system call started by
+// begin_opn(nblocks).
+// commits if this was the last outstanding operation
+// and no other process is committing.
+void
+end_opn(int nblocks)
 {
   int do_commit = 0;
 
   acquire(&log.lock);
   log.outstanding -= 1;
-  if(log.committing)
-    panic("log.committing");
-  if(log.outstanding == 0){
+  log.reserved -= nblocks;
+  if(log.outstanding == 0 && !log.committing){
     do_commit = 1;
     log.committing = 1;
   } else {
@@ -167,44 +244,164 @@ end_op(void)
     // call commit w/o holding locks, since not allowed
     // to sleep with locks.
     commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
   }
 }
 
-// Copy modified blocks from cache to log.
+// called at the end of each FS system call.
+void
+end_op(void)
+{
+  end_opn(MAXOPBLOCKS);
+}
+
+// Copy the blocks of the open transaction out of the cache into
+// the log slots after the committed ones. FS system calls are
+// held off by log.sealing, so the blocks cannot change underneath.
 static void
-write_log(void)
+copy_trans(void)
 {
-  int tail;
+  int i, slot;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
+  for (i = 0; i < log.lh.n; i++) {
+    slot = log.clh.n + i;
+    struct buf *from = bread(log.dev, log.lh.block[i]); // cache block
+    struct buf *to = log.copy[slot];
+    acquiresleep(&to->lock);
+    to->dev = log.dev;
     memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
+    log.clh.block[slot] = log.lh.block[i];
+    log.home[slot] = from;  // still pinned by log_write()
     brelse(from);
-    brelse(to);
   }
 }
 
+// Write the copies of the n sealed blocks to their log slots.
+static void
+write_log(int n)
+{
+  struct buf **b = &log.copy[log.clh.n];
+  int i;
+
+  for (i = 0; i < n; i++)
+    b[i]->blockno = log.start+log.clh.n+i+1;
+  bwritestartv(b, n);  // the log blocks are consecutive
+  for (i = 0; i < n; i++) {
+    bwait(b[i]);
+    releasesleep(&b[i]->lock);
+  }
+}
+
+// Write the newest copy of every block in the log to its home
+// location, empty the log, and let the cache evict the originals.
+// A block that several transactions wrote is written only once,
+// from its last slot.
+static void
+install_trans(void)
+{
+  struct buf **b = log.inst;
+  int i, j, n;
+
+  n = 0;
+  for (i = log.clh.n - 1; i >= 0; i--) {
+    for (j = i + 1; j < log.clh.n; j++) {
+      if (log.clh.block[j] == log.clh.block[i])
+        break;
+    }
+    if (j < log.clh.n)
+      continue;  // a later slot has newer contents
+    acquiresleep(&log.copy[i]->lock);
+    log.copy[i]->blockno = log.clh.block[i];
+    // Keep b[] sorted so that runs of blocks go out together.
+    for (j = n; j > 0 && b[j-1]->blockno > log.copy[i]->blockno; j--)
+      b[j] = b[j-1];
+    b[j] = log.copy[i];
+    n++;
+  }
+  bwritestartv(b, n);
+  for (i = 0; i < n; i++) {
+    bwait(b[i]);
+    releasesleep(&b[i]->lock);
+  }
+
+  j = log.clh.n;
+  log.clh.n = 0;
+  write_head();    // Erase the installed transactions from the log
+  for (i = 0; i < j; i++)
+    bunpin(log.home[i]);
+  log.nckptblocks += n;
+}
+
+// The log flusher, a kernel thread. Checkpoints the log whenever
+// commit() finds it full.
+static void
+logflusher(void)
+{
+  acquire(&log.lock);
+  for (;;) {
+    while (!log.flushing)
+      sleep(&log.flushing, &log.lock);
+    release(&log.lock);
+
+    install_trans();
+
+    acquire(&log.lock);
+    log.nckpt += 1;
+    log.flushing = 0;
+    wakeup(&log.flushing);
+  }
+}
+
+// Commit open transactions for as long as one is ready: it has
+// blocks and no FS system calls in progress. The caller has set
+// log.committing.
 static void
 commit()
 {
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(0); // Now install writes to home locations
+  uint start;
+  int n;
+
+  acquire(&log.lock);
+  while(log.outstanding == 0 && log.lh.n > 0){
+    if(log.clh.n + log.lh.n > log.size){
+      // No room after the committed blocks; have the flusher
+      // install them. FS system calls go on meanwhile.
+      log.flushing = 1;
+      wakeup(&log.flushing);
+      while(log.flushing)
+        sleep(&log.flushing, &log.lock);
+      continue;
+    }
+
+    log.sealing = 1;
+    release(&log.lock);
+    copy_trans();
+
+    acquire(&log.lock);
+    n = log.lh.n;
     log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+    log.sealing = 0;
+    wakeup(&log);
+    release(&log.lock);
+
+    start = ticks;
+    write_log(n);    // Write sealed blocks to log
+    log.clh.n += n;
+    write_head();    // Write header to disk -- the real commit
+    log.nblocks += n;
+
+    acquire(&log.lock);
+    log.ncommit += 1;
+    log.nticks += ticks - start;
   }
+  log.committing = 0;
+  wakeup(&log);
+  release(&log.lock);
 }
 
 // Caller has modified b->data and is done with the buffer.
 // Record the block number and pin in the cache by increasing refcnt.
-// commit()/write_log() will do the disk write.
+// commit()/write_log() will do the log write, and the
+// flusher's install_trans() the home write.
 //
 // log_write() replaces bwrite(); a typical use is:
 //   bp = bread(...)
@@ -217,7 +414,7 @@ log_write(struct buf *b)
   int i;
 
   acquire(&log.lock);
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+  if (log.lh.n >= log.size)
     panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
@@ -234,3 +431,17 @@ log_write(struct buf *b)
   release(&log.lock);
 }
 
+// Fill in the log section of ks.
+void
+logstats(struct kstats *ks)
+{
+  acquire(&log.lock);
+  ks->log_size = log.size;
+  ks->log_nop = log.nop;
+  ks->log_ncommit = log.ncommit;
+  ks->log_nblocks = log.nblocks;
+  ks->log_nticks = log.nticks;
+  ks->log_nckpt = log.nckpt;
+  ks->log_nckptblocks = log.nckptblocks;
+  release(&log.lock);
+}
@@ -26,7 +26,10 @@ main()
     plicinithart();  // ask PLIC for device interrupts
     binit();         // buffer cache
     iinit();         // inode table
+    dcinit();        // directory entry cache
+    pcinit();        // page cache
     fileinit();      // file table
+    pipeinit();      // pipe buffers
     virtio_disk_init(); // emulated hard disk
     userinit();      // first user process
     __sync_synchronize();
@@ -0,0 +1,289 @@
+// Memory-mapped files.
+//
+// mmap() only records a region in p->vma[]; pages are mapped on
+// the first fault, from the page cache (pcache.c), so processes
+// that map the same file share its pages.
+//
+// A MAP_SHARED page is mapped read-only even when the region is
+// writable, and becomes writable on the first store. Unmapping a
+// region writes the pages that were made writable back to the
+// file, through the log. A MAP_PRIVATE page of a writable region
+// is mapped copy-on-write, and the first store gives the process
+// its own copy with uvmcow(), as after fork().
+//
+// Regions are placed downwards from MMAPTOP, above the heap,
+// which growproc() keeps below the lowest region.
+//
+// Mapping a page may sleep, to lock the inode and read the page,
+// so copyin() and copyout() cannot do it while the caller holds a
+// spinlock, as piperead() and consoleread() do. Nor can they while
+// the caller holds an inode lock, as readi() and writei() do: a
+// process copying from file B into a mapping of A and another
+// copying from A into a mapping of B would deadlock. fileread()
+// and filewrite() call mmaptouch() first to map the pages they
+// will copy to or from.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "fs.h"
+#include "file.h"
+#include "fcntl.h"
+#include "stat.h"
+#include "defs.h"
+#include "kstats.h"
+
+uint64 mmap_nfault;
+
+// Return the lowest address mapped by one of p's regions, or
+// MMAPTOP if there are none.
+uint64
+mmapbase(struct proc *p)
+{
+  uint64 base = MMAPTOP;
+
+  for(struct vma *v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->addr && v->addr < base)
+      base = v->addr;
+  return base;
+}
+
+// Return p's region containing va, or 0.
+static struct vma*
+vmafind(struct proc *p, uint64 va)
+{
+  for(struct vma *v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->addr && va >= v->addr && va < v->addr + v->len)
+      return v;
+  return 0;
+}
+
+// Map len bytes of f, starting at file offset off, into the
+// current process. Returns the address, or -1.
+uint64
+mmap(uint64 len, int prot, int flags, struct file *f, uint off)
+{
+  struct proc *p = myproc();
+  struct vma *v, *free;
+  uint64 addr;
+
+  if(len == 0 || off % PGSIZE != 0 || f->type != FD_INODE || f->ip->type != T_FILE)
+    return -1;
+  if(flags != MAP_SHARED && flags != MAP_PRIVATE)
+    return -1;
+  if(!f->readable || (flags == MAP_SHARED && (prot & PROT_WRITE) && !f->writable))
+    return -1;
+
+  free = 0;
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->addr == 0 && free == 0)
+      free = v;
+  if(free == 0)
+    return -1;
+
+  // Leave a guard page above the heap.
+  len = PGROUNDUP(len);
+  addr = mmapbase(p) - len;
+  if(addr > MMAPTOP || addr < PGROUNDUP(p->sz) + PGSIZE)
+    return -1;
+
+  free->addr = addr;
+  free->len = len;
+  free->prot = prot;
+  free->flags = flags;
+  free->f = filedup(f);
+  free->off = off;
+  return addr;
+}
+
+// Handle a fault at va by p on a page of one of its regions:
+// map the page if it is not mapped, and make a MAP_SHARED page
+// writable if write is set. Returns 0 if p may now retry the
+// access, or -1 if va is not in a region or the region does
+// not allow it.
+int
+mmapfault(struct proc *p, uint64 va, int write)
+{
+  struct inode *ip;
+  struct vma *v;
+  pte_t *pte;
+  uint64 off;
+  int perm;
+  char *mem;
+
+  if((v = vmafind(p, va)) == 0)
+    return -1;
+  if(write && (v->prot & PROT_WRITE) == 0)
+    return -1;
+  va = PGROUNDDOWN(va);
+
+  if((pte = walk(p->pagetable, va, 0)) != 0 && (*pte & PTE_V)){
+    // Copy-on-write pages of MAP_PRIVATE regions are for uvmcow().
+    if(!write || v->flags != MAP_SHARED || (*pte & PTE_W))
+      return -1;
+    *pte |= PTE_W;
+    return 0;
+  }
+  if(holdingany() || p->nilock > 0)
+    return -1;
+
+  ip = v->f->ip;
+  ilock(ip);
+  off = v->off + (va - v->addr);
+  mem = 0;
+  if(off < ip->size)
+    mem = pcget(ip, off / PGSIZE);
+  iunlock(ip);
+  if(mem == 0)
+    return -1;
+  __sync_fetch_and_add(&mmap_nfault, 1);
+
+  perm = PTE_U | PTE_R;
+  if(v->prot & PROT_EXEC)
+    perm |= PTE_X;
+  if(v->prot & PROT_WRITE)
+    perm |= v->flags == MAP_SHARED ? (write ? PTE_W : 0) : PTE_COW;
+  if(mappages(p->pagetable, va, PGSIZE, (uint64)mem, perm) != 0){
+    kfree(mem);
+    return -1;
+  }
+  if(write && v->flags == MAP_PRIVATE)
+    return uvmcow(p->pagetable, va);
+  return 0;
+}
+
+// Map the pages of p's regions in the n bytes at va that are
+// not mapped yet, before the caller takes locks under which
+// copyin() or copyout() of those bytes could not map them.
+// Pages that cannot be mapped are left for the copy to fail on.
+void
+mmaptouch(struct proc *p, uint64 va, uint64 n)
+{
+  struct vma *v;
+  pte_t *pte;
+  uint64 a, end;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->addr == 0 || va + n <= v->addr || va >= v->addr + v->len)
+      continue;
+    a = va > v->addr ? PGROUNDDOWN(va) : v->addr;
+    end = va + n < v->addr + v->len ? va + n : v->addr + v->len;
+    for(; a < end; a += PGSIZE){
+      if((pte = walk(p->pagetable, a, 0)) == 0 || (*pte & PTE_V) == 0)
+        mmapfault(p, a, 0);
+    }
+  }
+}
+
+// Remove the n bytes at a from region v of p, writing back the
+// pages of a MAP_SHARED region that were written.
+static void
+vmaunmap(struct proc *p, struct vma *v, uint64 a, uint64 n)
+{
+  struct inode *ip = v->f->ip;
+  uint64 va, off;
+  pte_t *pte;
+  uint m;
+
+  if(v->flags == MAP_SHARED && (v->prot & PROT_WRITE)){
+    for(va = a; va < a + n; va += PGSIZE){
+      if((pte = walk(p->pagetable, va, 0)) == 0 || (*pte & PTE_W) == 0)
+        continue;
+      begin_op();
+      ilock(ip);
+      off = v->off + (va - v->addr);
+      if(off < ip->size){
+        m = ip->size - off < PGSIZE ? ip->size - off : PGSIZE;
+        writei(ip, 0, PTE2PA(*pte), off, m);
+      }
+      iunlock(ip);
+      end_op();
+    }
+  }
+  uvmunmap(p->pagetable, a, n / PGSIZE, 1);
+
+  if(a == v->addr){
+    v->addr += n;
+    v->off += n;
+  }
+  v->len -= n;
+  if(v->len == 0){
+    fileclose(v->f);
+    v->addr = 0;
+    v->f = 0;
+  }
+}
+
+// Unmap len bytes at addr from the current process. The range
+// must be at the start or end of a region, or all of it.
+// Returns 0 on success, -1 on error.
+int
+munmap(uint64 addr, uint64 len)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+
+  len = PGROUNDUP(len);
+  if(addr % PGSIZE != 0 || len == 0 || (v = vmafind(p, addr)) == 0)
+    return -1;
+  if(addr + len > v->addr + v->len)
+    return -1;
+  if(addr != v->addr && addr + len != v->addr + v->len)
+    return -1;
+  vmaunmap(p, v, addr, len);
+  return 0;
+}
+
+// Unmap all of p's regions, for exit() and exec().
+void
+mmapexit(struct proc *p)
+{
+  for(struct vma *v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->addr)
+      vmaunmap(p, v, v->addr, v->len);
+}
+
+// Give child np the regions of p. Pages of MAP_SHARED regions
+// are shared, and those of MAP_PRIVATE regions copy-on-write.
+// Returns 0 on success, -1 on failure. Called with np->lock
+// held, so it must not sleep.
+int
+mmapfork(struct proc *p, struct proc *np)
+{
+  struct vma *v, *nv;
+
+  for(v = p->vma, nv = np->vma; v < &p->vma[NVMA]; v++, nv++){
+    if(v->addr == 0)
+      continue;
+    if(uvmdup(p->pagetable, np->pagetable, v->addr, v->addr + v->len,
+              v->flags == MAP_PRIVATE) < 0)
+      goto bad;
+    *nv = *v;
+    filedup(nv->f);
+  }
+  return 0;
+
+ bad:
+  // p still maps every page and holds every file, so there is
+  // nothing to write back and fileclose() will not sleep.
+  for(nv = np->vma; nv < &np->vma[NVMA]; nv++){
+    if(nv->addr){
+      uvmunmap(np->pagetable, nv->addr, nv->len / PGSIZE, 1);
+      fileclose(nv->f);
+      nv->addr = 0;
+      nv->f = 0;
+    }
+  }
+  return -1;
+}
+
+// Fill in the mmap section of ks.
+void
+mmapstats(struct kstats *ks)
+{
+  ks->mmap_nfault = mmap_nfault;
+}
@@ -2,14 +2,21 @@
 #define NCONT         4  // maximum number of containers
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NVMA         16  // mmap()ed regions per process
+#define NINODE       50  // unreferenced i-nodes kept cached
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       64  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       2000  // size of file system in blocks
+#define NDISKSEG      8  // max blocks in one disk request
+#define NPCRA         8  // max pages the page cache reads at once
+#define LOGSIZE      (MAXOPBLOCKS*12) // data blocks in the on-disk log made by mkfs
+#define NBUF         (MAXOPBLOCKS*3)  // minimum size of disk block cache
+#define NSLAB         8  // maximum number of slab caches
+#define MAXORDER     10  // largest kalloc_order() block is 2^MAXORDER pages
+#ifndef FSSIZE
+#define FSSIZE       2000  // size of file system in blocks; see Makefile
+#endif
 #define MAXPATH      128   // maximum file path name
 #define NCONS        4     // maximum number of consoles
+#define CWEIGHT      100   // default container CPU weight
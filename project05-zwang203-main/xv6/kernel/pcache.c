@@ -0,0 +1,279 @@
+// Page cache.
+//
+// Holds whole pages of file data, keyed by (dev, inum, page
+// number). readi() reads regular files through it, and every
+// process that mmap()s a file maps the same physical page. Pages
+// are read from the disk with ireadpages(), which does not add
+// the blocks to the buffer cache, so reading a large file does
+// not push metadata out of it. writei() still writes through the
+// buffer cache and the log, and copies what it writes into any
+// cached page, so a page never holds anything the file does not.
+//
+// The cache holds one reference to each page (see kref()), and
+// every mapping of the page holds another. Only a page that
+// nothing maps can be dropped, which is what keeps a mapped
+// page in the cache for as long as it is mapped.
+//
+// Interface:
+// * pcget() returns a file page with a new reference.
+// * pcupdate() copies data writei() wrote into a cached page.
+// * pcpurge() drops the pages of a file that is truncated.
+//
+// Callers of pcget(), pcupdate() and pcpurge() must hold the
+// inode's lock, so a page is filled by one process at a time and
+// cannot change while it is filled. The pcache lock only protects
+// the table itself.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "riscv.h"
+#include "list.h"
+#include "defs.h"
+#include "fs.h"
+#include "file.h"
+#include "kstats.h"
+
+#define NPCACHE 1024  // pages cached, or more while memory is plentiful
+#define PCHIGH  4096  // ... which is while this many pages are free
+#define PCSHRINK 16   // pages dropped per miss while over NPCACHE
+#define NPCHASH 61    // hash buckets
+
+struct page {
+  struct list_elem elem;  // On a hash bucket list
+  struct list_elem lru;   // On pcache.lru, most recent first
+  uint dev;
+  uint inum;
+  uint pgno;              // Page number in the file
+  char *data;
+};
+
+struct {
+  struct spinlock lock;
+  struct slabcache *cache;
+  struct list lru;
+  struct list bucket[NPCHASH];
+  int npage;
+
+  uint64 nhit;
+  uint64 nmiss;
+  uint64 nra;     // pages read ahead
+  uint64 nevict;
+} pcache;
+
+#define PCHASH(dev, inum, pgno) (((dev) * 31 + (inum) * 17 + (pgno)) % NPCHASH)
+
+void
+pcinit(void)
+{
+  initlock(&pcache.lock, "pcache");
+  pcache.cache = slabcreate("page", sizeof(struct page));
+  list_init(&pcache.lru);
+  for(int i = 0; i < NPCHASH; i++)
+    list_init(&pcache.bucket[i]);
+}
+
+// Find page pgno of inode inum. Caller must hold pcache.lock.
+static struct page*
+pcfind(uint dev, uint inum, uint pgno)
+{
+  struct list *l = &pcache.bucket[PCHASH(dev, inum, pgno)];
+  struct list_elem *e;
+  struct page *pg;
+
+  for(e = list_begin(l); e != list_end(l); e = list_next(e)){
+    pg = list_entry(e, struct page, elem);
+    if(pg->inum == inum && pg->pgno == pgno && pg->dev == dev)
+      return pg;
+  }
+  return 0;
+}
+
+// Take pg out of the cache. Caller must hold pcache.lock, and
+// must free pg and drop its reference to pg->data after
+// releasing it.
+static void
+pcdrop(struct page *pg)
+{
+  list_remove(&pg->elem);
+  list_remove(&pg->lru);
+  pcache.npage--;
+}
+
+// Drop up to n pages that nothing maps, least recently used
+// first, onto the list l. Caller must hold pcache.lock.
+static int
+pcshrink(int n, struct list *l)
+{
+  struct list_elem *e, *prev;
+  struct page *pg;
+  int i = 0;
+
+  for(e = list_rbegin(&pcache.lru); i < n && e != list_rend(&pcache.lru); e = prev){
+    prev = list_prev(e);
+    pg = list_entry(e, struct page, lru);
+    if(krefcnt(pg->data) == 1){
+      pcdrop(pg);
+      list_push_back(l, &pg->lru);
+      i++;
+    }
+  }
+  pcache.nevict += i;
+  return i;
+}
+
+// Free the pages pcshrink() put on l.
+static void
+pcfree(struct list *l)
+{
+  struct page *pg;
+
+  while(!list_empty(l)){
+    pg = list_entry(list_pop_front(l), struct page, lru);
+    kfree(pg->data);
+    slabfree(pcache.cache, pg);
+  }
+}
+
+// Free every page that nothing maps, for kalloc() when it has
+// run out of pages. Returns the number freed.
+int
+pcreclaim(void)
+{
+  struct list l;
+  int n;
+
+  // pcget() does not allocate with pcache.lock held, but be safe.
+  if(holding(&pcache.lock))
+    return 0;
+  list_init(&l);
+  acquire(&pcache.lock);
+  n = pcshrink(pcache.npage, &l);
+  release(&pcache.lock);
+  pcfree(&l);
+  return n;
+}
+
+// Return the data of page pgno of ip, reading it if it is not
+// cached, with a reference the caller must give up with kfree().
+// The part of the page past the end of the file is zero.
+// Returns 0 if there is no memory. Caller must hold ip->lock.
+//
+// A miss on the page just past those the last miss read is taken
+// to be a sequential read, and reads twice as many pages ahead as
+// that one did, up to NPCRA, in one go.
+char*
+pcget(struct inode *ip, uint pgno)
+{
+  struct page *pg[NPCRA];
+  char *mem[NPCRA];
+  struct list l;
+  int win, n, low;
+  uint last;
+
+  acquire(&pcache.lock);
+  if((pg[0] = pcfind(ip->dev, ip->inum, pgno)) != 0){
+    pcache.nhit++;
+    list_remove(&pg[0]->lru);
+    list_push_front(&pcache.lru, &pg[0]->lru);
+    kref(pg[0]->data);
+    release(&pcache.lock);
+    return pg[0]->data;
+  }
+  pcache.nmiss++;
+
+  // Holding ip->lock means no one else can add these pages.
+  win = 1;
+  if(pgno == ip->ranext && ip->rawin > 0)
+    win = ip->rawin * 2 < NPCRA ? ip->rawin * 2 : NPCRA;
+  last = ip->size > 0 ? (ip->size - 1) / PGSIZE : 0;
+  for(n = 1; n < win && pgno + n <= last; n++)
+    if(pcfind(ip->dev, ip->inum, pgno + n))
+      break;
+  release(&pcache.lock);
+
+  for(int i = 0; i < n; i++){
+    if((pg[i] = slaballoc(pcache.cache)) == 0 || (mem[i] = kalloc()) == 0){
+      if(pg[i])
+        slabfree(pcache.cache, pg[i]);
+      if((n = i) == 0)
+        return 0;
+      break;
+    }
+  }
+  ip->rawin = win;
+  ip->ranext = pgno + n;
+  ireadpages(ip, pgno, n, mem);
+
+  low = kpages() < PCHIGH;
+  list_init(&l);
+  acquire(&pcache.lock);
+  for(int i = 0; i < n; i++){
+    pg[i]->dev = ip->dev;
+    pg[i]->inum = ip->inum;
+    pg[i]->pgno = pgno + i;
+    pg[i]->data = mem[i];
+    list_push_front(&pcache.bucket[PCHASH(ip->dev, ip->inum, pgno + i)], &pg[i]->elem);
+    list_push_front(&pcache.lru, &pg[i]->lru);
+  }
+  pcache.npage += n;
+  pcache.nra += n - 1;
+  kref(mem[0]);
+  if(pcache.npage > NPCACHE && low)
+    pcshrink(PCSHRINK, &l);
+  release(&pcache.lock);
+  pcfree(&l);
+  return mem[0];
+}
+
+// writei() wrote the n bytes at src to offset off of ip; copy
+// them into ip's cached page, if any. They must not cross a
+// page boundary. Caller must hold ip->lock.
+void
+pcupdate(struct inode *ip, uint off, char *src, uint n)
+{
+  struct page *pg;
+
+  acquire(&pcache.lock);
+  if((pg = pcfind(ip->dev, ip->inum, off / PGSIZE)) != 0)
+    memmove(pg->data + off % PGSIZE, src, n);
+  release(&pcache.lock);
+}
+
+// Drop every cached page of ip, whose data is being freed.
+// Pages that are still mapped stay with their mappings.
+// Caller must hold ip->lock.
+void
+pcpurge(struct inode *ip)
+{
+  struct list_elem *e, *next;
+  struct page *pg;
+  struct list l;
+
+  list_init(&l);
+  acquire(&pcache.lock);
+  for(e = list_begin(&pcache.lru); e != list_end(&pcache.lru); e = next){
+    next = list_next(e);
+    pg = list_entry(e, struct page, lru);
+    if(pg->inum == ip->inum && pg->dev == ip->dev){
+      pcdrop(pg);
+      list_push_back(&l, &pg->lru);
+    }
+  }
+  release(&pcache.lock);
+  pcfree(&l);
+}
+
+// Fill in the page cache section of ks.
+void
+pcstats(struct kstats *ks)
+{
+  acquire(&pcache.lock);
+  ks->pc_nhit = pcache.nhit;
+  ks->pc_nmiss = pcache.nmiss;
+  ks->pc_nra = pcache.nra;
+  ks->pc_nevict = pcache.nevict;
+  ks->pc_npage = pcache.npage;
+  release(&pcache.lock);
+}
@@ -30,6 +30,15 @@ struct spinlock cont_run_lock;
 struct cont *cont_root;
 int cont_init = 0;
 
+// Containers are scheduled by stride scheduling. Every tick charged to a
+// container advances its pass by STRIDE1/weight, and each cpu picks the
+// container with the smallest pass among those it has processes queued
+// for. cont_vtime is the largest pass picked so far; a container that had
+// nothing runnable is brought up to it so that it cannot bank CPU time
+// while idle.
+#define STRIDE1 (1 << 20)
+uint64 cont_vtime;
+
 // Proc array
 struct proc proc[NPROC];
 
@@ -40,6 +49,19 @@ struct spinlock unused_lock;
 struct list run_list;
 struct spinlock run_lock; 
 
+// Sleeping processes are queued on a hash table keyed by wait
+// channel, so that wakeup() only looks at the processes that might
+// be sleeping on its channel. A SLEEPING process is on no run queue,
+// so its p->elem links it into its bucket's list.
+// A bucket's lock must be acquired before any p->lock.
+#define NSLEEPQ 61
+#define SLEEPQ(chan) (&sleepq[((uint64)(chan) >> 3) % NSLEEPQ])
+
+struct sleepq {
+  struct spinlock lock;
+  struct list procs;
+} sleepq[NSLEEPQ];
+
 struct proc *initproc;
 
 int nextpid = 1;
@@ -137,7 +159,7 @@ alloccont(char *cname, int max_mem_bytes, char *crootdir, int max_disk_bytes)
   // are separate from PIDs in other containers (name-space isolation).
   c->nextpid = 1;
   list_init(&c->proc_list);
-  list_init(&c->run_list);
+  c->nrunnable = 0;
 
   // Set the name of the container
   safestrcpy(c->name, cname, sizeof(c->name));
@@ -163,6 +185,10 @@ alloccont(char *cname, int max_mem_bytes, char *crootdir, int max_disk_bytes)
   c->used_mem_bytes = 0;
   c->used_disk_bytes = 0;
   c->nticks = 0;
+
+  // Start with the default CPU share at the current virtual time.
+  c->weight = CWEIGHT;
+  c->pass = cont_vtime;
   
   release(&c->lock);
 
@@ -175,10 +201,25 @@ procinit(void)
 {
   struct proc *p;
   struct cont *c;
+  struct cpu *cpu;
+  struct sleepq *sq;
   
   initlock(&pid_lock, "nextpid");
   initlock(&wait_lock, "wait_lock");
 
+  for(sq = sleepq; sq < &sleepq[NSLEEPQ]; sq++){
+    initlock(&sq->lock, "sleepq");
+    list_init(&sq->procs);
+  }
+
+  // Per-cpu run queues.
+  for(cpu = cpus; cpu < &cpus[NCPU]; cpu++){
+    initlock(&cpu->lock, "cpu_run_lock");
+    for(int i = 0; i < NCONT; i++)
+      list_init(&cpu->run_list[i]);
+    cpu->nrun = 0;
+  }
+
   // Containers
   
   initlock(&cont_run_lock, "cont_run_lock");
@@ -265,6 +306,142 @@ mycont(void)
   return cp;
 }
 
+// Put p at the end of its container's run list on cpu p->cpu. If the
+// container had nothing runnable, bring its pass up to the current
+// virtual time first. p->state must already be RUNNABLE.
+static void
+runq_push(struct proc *p)
+{
+  struct cont *contp = p->contp;
+  struct cpu *c = &cpus[p->cpu];
+
+  if(__sync_fetch_and_add(&contp->nrunnable, 1) == 0){
+    acquire(&contp->lock);
+    if(contp->pass < cont_vtime)
+      contp->pass = cont_vtime;
+    release(&contp->lock);
+  }
+
+  acquire(&c->lock);
+  list_push_back(&c->run_list[contp - cont], &p->elem);
+  c->nrun += 1;
+  release(&c->lock);
+}
+
+// Remove and return the process at the front of the run list of the
+// container with the smallest pass among those queued on cpu c.
+// Returns 0 if c has nothing queued.
+static struct proc*
+runq_pop(struct cpu *c)
+{
+  struct list_elem *e;
+  uint64 minpass = 0;
+  int i, best = -1;
+
+  acquire(&c->lock);
+  for(i = 0; i < NCONT; i++){
+    if(list_empty(&c->run_list[i]))
+      continue;
+    // pass is read without the container lock; a stale value only
+    // skews the choice by a tick.
+    if(best < 0 || cont[i].pass < minpass){
+      best = i;
+      minpass = cont[i].pass;
+    }
+  }
+  if(best < 0){
+    release(&c->lock);
+    return 0;
+  }
+  e = list_pop_front(&c->run_list[best]);
+  c->nrun -= 1;
+  release(&c->lock);
+
+  __sync_fetch_and_sub(&cont[best].nrunnable, 1);
+  if(minpass > cont_vtime)
+    cont_vtime = minpass;
+
+  return list_entry(e, struct proc, elem);
+}
+
+// Take a process queued on the most loaded other cpu.
+// Returns 0 if every other cpu's run queue is empty.
+static struct proc*
+runq_steal(struct cpu *c)
+{
+  struct cpu *victim, *v;
+  struct proc *p;
+
+  victim = 0;
+  for(v = cpus; v < &cpus[NCPU]; v++){
+    // nrun is only a hint here; runq_pop() rechecks under the lock.
+    if(v == c || !v->online || v->nrun == 0)
+      continue;
+    if(victim == 0 || v->nrun > victim->nrun)
+      victim = v;
+  }
+  if(victim == 0)
+    return 0;
+
+  p = runq_pop(victim);
+  if(p)
+    c->nsteal += 1;
+  return p;
+}
+
+// Choose the cpu whose run queue a newly forked process goes on.
+// Prefer the parent's cpu, whose cache holds the pages the child is
+// about to touch, unless it already has more queued work than the
+// least loaded online cpu.
+static int
+placecpu(void)
+{
+  struct cpu *c, *least;
+  int id;
+
+  push_off();
+  id = cpuid();
+  pop_off();
+
+  least = &cpus[id];
+  for(c = cpus; c < &cpus[NCPU]; c++){
+    if(c->online && c->nrun < least->nrun)
+      least = c;
+  }
+  if(cpus[id].nrun > least->nrun + 1)
+    id = least - cpus;
+
+  return id;
+}
+
+// Containers
+
+// Charge delta bytes of user memory to contp, or credit them back
+// if delta is negative. This is the size of the address spaces of
+// the container's processes; pages shared copy-on-write after a
+// fork are charged to every process that maps them.
+void
+contmem(struct cont *contp, int delta)
+{
+  acquire(&contp->lock);
+  contp->used_mem_bytes += delta;
+  release(&contp->lock);
+}
+
+// Charge one clock tick to p and to its container.
+// Called from the timer interrupt path with p RUNNING.
+void
+proctick(struct proc *p)
+{
+  struct cont *contp = p->contp;
+
+  p->nticks += 1;
+  acquire(&contp->lock);
+  contp->nticks += 1;
+  contp->pass += STRIDE1 / contp->weight;
+  release(&contp->lock);
+}
+
 int
 allocpid(struct cont *contp)
 {
@@ -281,18 +458,13 @@ allocpid(struct cont *contp)
   return pid;
 }
 
-// Look in the process table for an UNUSED proc.
-// If found, initialize state required to run in the kernel,
-// and return with p->lock held.
-// If there are no free procs, or a memory allocation fails, return 0.
-
-// Containers - now we pass a container points into allocproc so that
-// the new proc can point to the container it belongs to.
+// Take an UNUSED proc off the unused list, and return it with
+// p->lock held, or 0 if there is none.
 static struct proc*
-allocproc(struct cont *contp)
+procslot(void)
 {
-  struct proc *p;
   struct list_elem *e;
+  struct proc *p;
 
   e = 0;
   acquire(&unused_lock);
@@ -307,6 +479,23 @@ allocproc(struct cont *contp)
 
   p = list_entry(e, struct proc, elem);
   acquire(&p->lock);
+  return p;
+}
+
+// Look in the process table for an UNUSED proc.
+// If found, initialize state required to run in the kernel,
+// and return with p->lock held.
+// If there are no free procs, or a memory allocation fails, return 0.
+
+// Containers - now we pass a container points into allocproc so that
+// the new proc can point to the container it belongs to.
+static struct proc*
+allocproc(struct cont *contp)
+{
+  struct proc *p;
+
+  if((p = procslot()) == 0)
+    return 0;
 
   // Containers - now we get a new pid from the nextpid in the container.
   p->pid = allocpid(contp);
@@ -335,6 +524,8 @@ allocproc(struct cont *contp)
 
   p->nsched = 0;
   p->nticks = 0;
+  p->nilock = 0;
+  p->text = 0;
 
   p->contp = contp;
 
@@ -368,6 +559,8 @@ freecont(struct cont *contp)
   contp->used_mem_bytes = 0;
   contp->used_disk_bytes = 0;
   contp->nticks = 0;
+  contp->weight = 0;
+  contp->pass = 0;
 }
 
 // free a proc structure and the data hanging from it,
@@ -383,6 +576,8 @@ freeproc(struct proc *p)
   p->trapframe = 0;
   if(p->pagetable)
     proc_freepagetable(p->pagetable, p->sz);
+  if(p->sz)
+    contmem(p->contp, -(int)p->sz);
   p->pagetable = 0;
   p->sz = 0;
   p->pid = 0;
@@ -492,6 +687,7 @@ userinit(void)
   // and data into it.
   uvmfirst(p->pagetable, initcode, sizeof(initcode));
   p->sz = PGSIZE;
+  contmem(p->contp, p->sz);
 
   // prepare for the very first "return" from kernel to user.
   p->trapframe->epc = 0;      // user program counter
@@ -499,6 +695,7 @@ userinit(void)
 
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
+  p->cpu = 0;
 
   p->state = RUNNABLE;
 
@@ -507,12 +704,58 @@ userinit(void)
   // Containers
 
   // Put the first process on the run list of the root container.
-  acquire(&cont_root->lock);
-  list_push_back(&cont_root->run_list, &p->elem);
-  release(&cont_root->lock);
+  runq_push(p);
+}
+
+// A kernel thread's very first scheduling will swtch here.
+static void
+kthreadret(void)
+{
+  // Still holding p->lock from scheduler.
+  release(&myproc()->lock);
+  myproc()->kfn();
+  panic("kthreadret");
+}
+
+// Start a process that runs fn() in the kernel and never
+// returns to user space. fn() must not return.
+//
+// A kernel thread has no user memory, trapframe or page table.
+// It is not one of any container's processes, so it takes no
+// container pid, is not counted by cinfo(), and is not listed by
+// sproc() or found by uproc() and kill(). Its pid is negative, to
+// tell it apart in sleeplocks. It still needs a run queue, and is
+// scheduled on the root container's, so the CPU time it uses is
+// charged to the root container, as the kernel's own work.
+void
+kthread(char *name, void (*fn)(void))
+{
+  struct proc *p;
+
+  if((p = procslot()) == 0)
+    panic("kthread");
+  p->pid = -1 - (p - proc);
+  p->state = USED;
+  memset(&p->context, 0, sizeof(p->context));
+  p->context.ra = (uint64)kthreadret;
+  p->context.sp = p->kstack + PGSIZE;
+  p->nsched = 0;
+  p->nticks = 0;
+  p->nilock = 0;
+  p->text = 0;
+  p->contp = cont_root;
+  p->kfn = fn;
+  safestrcpy(p->name, name, sizeof(p->name));
+  p->cpu = 0;
+  p->state = RUNNABLE;
+  release(&p->lock);
+
+  runq_push(p);
 }
 
 // Grow or shrink user memory by n bytes.
+// Growing only reserves the address space; usertrap() and
+// copyin()/copyout() allocate each page on first use.
 // Return 0 on success, -1 on failure.
 int
 growproc(int n)
@@ -522,12 +765,13 @@ growproc(int n)
 
   sz = p->sz;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0) {
+    if(sz + n > mmapbase(p) - PGSIZE)
       return -1;
-    }
+    sz += n;
   } else if(n < 0){
     sz = uvmdealloc(p->pagetable, sz, sz + n);
   }
+  contmem(p->contp, sz - p->sz);
   p->sz = sz;
   return 0;
 }
@@ -550,13 +794,14 @@ fork(struct cont *contp)
     return -1;
   }
 
-  // Copy user memory from parent to child.
-  if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
+  // Share user memory copy-on-write between parent and child.
+  if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0 || mmapfork(p, np) < 0){
     freeproc(np);
     release(&np->lock);
     return -1;
   }
   np->sz = p->sz;
+  contmem(contp, np->sz);
 
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
@@ -569,6 +814,11 @@ fork(struct cont *contp)
     if(p->ofile[i])
       np->ofile[i] = filedup(p->ofile[i]);
   np->cwd = idup(p->cwd);
+  if(p->text){
+    // Cannot fail: p's count keeps writers out.
+    np->text = idup(p->text);
+    itextget(np->text);
+  }
 
   safestrcpy(np->name, p->name, sizeof(p->name));
 
@@ -582,14 +832,13 @@ fork(struct cont *contp)
 
   acquire(&np->lock);
   np->state = RUNNABLE;
+  np->cpu = placecpu();
   release(&np->lock);
 
   // Containers
 
   // Add the new process to the container's run list.
-  acquire(&contp->lock);
-  list_push_back(&contp->run_list, &np->elem);
-  release(&contp->lock);
+  runq_push(np);
 
   return pid;
 }
@@ -626,6 +875,8 @@ exit(int status)
   if(p == initproc)
     panic("init exiting");
 
+  mmapexit(p);
+
   // Close all open files.
   for(int fd = 0; fd < NOFILE; fd++){
     if(p->ofile[fd]){
@@ -635,10 +886,15 @@ exit(int status)
     }
   }
 
+  if(p->text)
+    itextput(p->text);
   begin_op();
   iput(p->cwd);
+  if(p->text)
+    iput(p->text);
   end_op();
   p->cwd = 0;
+  p->text = 0;
 
   // Containers
 
@@ -736,40 +992,29 @@ scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
-  struct list_elem *e;
-  struct cont *contp;
   
   c->proc = 0;
+  c->online = 1;
   for(;;){
     // Avoid deadlock by ensuring that devices can interrupt.
     intr_on();
 
     // Containers
 
-    // This code only schedules processes in the root container.
-    contp = cont_root;
-
-    // Get a process from the container's run_list.
-    acquire(&contp->lock);
-    e = 0;
-    if(!list_empty(&contp->run_list)){
-      e = list_begin(&contp->run_list);
-      list_remove(e);
-    }
-    release(&contp->lock);
-
-    if(e == 0){
+    // Run the next process of the container furthest behind its CPU
+    // share on this cpu's run queue. If this cpu has nothing queued,
+    // steal from the busiest other cpu.
+    if((p = runq_pop(c)) == 0 && (p = runq_steal(c)) == 0){
       asm volatile("wfi");
       continue;
     }
 
-    p = list_entry(e, struct proc, elem);
-
     acquire(&p->lock);
     //debug_print("p->name = %s\n", p->name);
     ASSERT(p->state == RUNNABLE);
     p->state = RUNNING;
     p->nsched += 1;
+    p->cpu = c - cpus;
     c->proc = p;
 
     swtch(&c->context, &p->context);
@@ -813,16 +1058,13 @@ void
 yield(void)
 {
   struct proc *p = myproc();
-  struct cont *contp = mycont();
   acquire(&p->lock);
   p->state = RUNNABLE;
 
   // Containers
 
   // Put the current process at the end of the container's run list.
-  acquire(&contp->lock);
-  list_push_back(&contp->run_list, &p->elem);
-  release(&contp->lock);
+  runq_push(p);
   sched();
   release(&p->lock);
 }
@@ -855,20 +1097,27 @@ void
 sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
+  struct sleepq *sq = SLEEPQ(chan);
   
   // Must acquire p->lock in order to
   // change p->state and then call sched.
-  // Once we hold p->lock, we can be
+  // Once we hold chan's bucket lock, we can be
   // guaranteed that we won't miss any wakeup
-  // (wakeup locks p->lock),
+  // (wakeup locks the bucket, then p->lock,
+  // and we hold p->lock until we have switched away),
   // so it's okay to release lk.
 
+  acquire(&sq->lock);
   acquire(&p->lock);  //DOC: sleeplock1
-  release(lk);
 
-  // Go to sleep.
+  // Go to sleep. Join the bucket before releasing lk so that
+  // wakeup()'s unlocked empty check cannot miss us.
   p->chan = chan;
   p->state = SLEEPING;
+  list_push_back(&sq->procs, &p->elem);
+
+  release(lk);
+  release(&sq->lock);
 
   sched();
 
@@ -885,27 +1134,52 @@ sleep(void *chan, struct spinlock *lk)
 void
 wakeup(void *chan)
 {
+  struct sleepq *sq = SLEEPQ(chan);
+  struct list_elem *e, *next;
   struct proc *p;
-  struct cont *contp;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
-    if(p != myproc()){
-      acquire(&p->lock);
-      if(p->state == SLEEPING && p->chan == chan) {
-        p->state = RUNNABLE;
+  // A sleeper adds itself to the bucket before releasing the lock
+  // that the caller of wakeup() holds, so an empty bucket seen here
+  // without the bucket lock means there is no one to wake.
+  if(list_empty(&sq->procs))
+    return;
+
+  acquire(&sq->lock);
+  for(e = list_begin(&sq->procs); e != list_end(&sq->procs); e = next){
+    next = list_next(e);
+    p = list_entry(e, struct proc, elem);
+    if(p->chan != chan)
+      continue;
+    acquire(&p->lock);
+    list_remove(e);
+    p->state = RUNNABLE;
 
-        // Containers
+    // Containers
 
-        // Put the process we are waking up at the end of the container's
-        // run list in which the process exists.
-        contp = p->contp;
-        acquire(&contp->lock);
-        list_push_back(&contp->run_list, &p->elem);
-        release(&contp->lock);
-      }
-      release(&p->lock);
-    }
+    // Put the process we are waking up at the end of the container's
+    // run list in which the process exists.
+    runq_push(p);
+    release(&p->lock);
   }
+  release(&sq->lock);
+}
+
+// Wake p if it is still sleeping on chan.
+// Must be called without any p->lock.
+static void
+wakeproc(struct proc *p, void *chan)
+{
+  struct sleepq *sq = SLEEPQ(chan);
+
+  acquire(&sq->lock);
+  acquire(&p->lock);
+  if(p->state == SLEEPING && p->chan == chan){
+    list_remove(&p->elem);
+    p->state = RUNNABLE;
+    runq_push(p);
+  }
+  release(&p->lock);
+  release(&sq->lock);
 }
 
 // Kill the process with the given pid.
@@ -915,26 +1189,24 @@ int
 kill(int pid)
 {
   struct proc *p;
-  struct cont *contp;
+  void *chan;
 
   for(p = proc; p < &proc[NPROC]; p++){
     acquire(&p->lock);
-    if(p->pid == pid){
+    if(p->pid == pid && p->state != UNUSED && p->kfn == 0){
       p->killed = 1;
-      if(p->state == SLEEPING){
-        // Wake process from sleep().
-        p->state = RUNNABLE;
-
-        // Containers
-
-        // Put the process we are killing at the end of the container's
-        // run list to allow it to be scheduled, and then exit.
-        contp = p->contp;
-        acquire(&contp->lock);
-        list_push_back(&contp->run_list, &p->elem);
-        release(&contp->lock);
-      }
+      chan = p->state == SLEEPING ? p->chan : 0;
       release(&p->lock);
+
+      // Wake process from sleep(). The sleep queue lock must be
+      // taken before p->lock, so wakeproc() rechecks the state.
+
+      // Containers
+
+      // wakeproc() puts the process at the end of its container's
+      // run list to allow it to be scheduled, and then exit.
+      if(chan)
+        wakeproc(p, chan);
       return 0;
     }
     release(&p->lock);
@@ -1032,7 +1304,7 @@ uproc(int pid, uint64 up_p)
   
   // Find proc struct for pid
   for(p = proc; p < &proc[NPROC]; p++){
-    if(p->state != UNUSED && p->pid == pid){
+    if(p->state != UNUSED && p->pid == pid && p->kfn == 0){
       acquire(&p->lock);
       up.pid = p->pid;
       up.state = p->state;
@@ -1060,12 +1332,18 @@ sproc(int slot, uint64 up_p)
 
   p = &proc[slot];
   acquire(&p->lock);
-  up.pid = p->pid;
-  up.state = p->state;
-  up.sz = p->sz;
-  strncpy(up.name, p->name, 16);
-  up.nsched = p->nsched;
-  up.nticks = p->nticks;
+  if(p->kfn){
+    // Kernel threads are not listed.
+    memset(&up, 0, sizeof(up));
+    up.state = UNUSED;
+  } else {
+    up.pid = p->pid;
+    up.state = p->state;
+    up.sz = p->sz;
+    strncpy(up.name, p->name, 16);
+    up.nsched = p->nsched;
+    up.nticks = p->nticks;
+  }
   release(&p->lock);
   if(copyout(myp->pagetable, up_p, (char *)&up, sizeof(up)) < 0)
     return -1;
@@ -1088,10 +1366,10 @@ contdump(void)
     acquire(&c->lock);
     nprocs = list_size(&c->proc_list);
     release(&c->lock);
-    printf("[%s] %d procs %d/%d mem %d/%d disk %d ticks", c->name, nprocs,
-           c->used_mem_bytes, c->max_mem_bytes,
+    printf("[%s] %d procs %d/%d mem %d/%d disk %d ticks %d weight", c->name,
+           nprocs, c->used_mem_bytes, c->max_mem_bytes,
            c->used_disk_bytes, c->max_disk_bytes,
-           c->nticks);
+           c->nticks, c->weight);
 
     printf("\n");
   }
@@ -1119,6 +1397,7 @@ cinfo(uint64 up_p)
       ci.used_disk_bytes = c->used_disk_bytes;
       ci.nprocs = list_size(&c->proc_list);
       ci.nticks = c->nticks;
+      ci.weight = c->weight;
       release(&c->lock);
       if(copyout(myp->pagetable, up_p, (char *)&ci, sizeof(ci)) < 0)
         return -1;
@@ -1147,3 +1426,27 @@ cfork(char *cname, int max_mem_bytes, char *crootdir, int max_disk_bytes)
 
   return fork(contp);
 }
+
+// Set the CPU weight of the named container. A container with twice the
+// weight of another receives twice as many ticks when both are busy.
+// Returns 0 on success, -1 if there is no such container.
+int
+cweight(char *cname, int weight)
+{
+  struct cont *c;
+
+  if(weight < 1 || weight > STRIDE1)
+    return -1;
+
+  for(c = cont; c < &cont[NCONT]; c++){
+    acquire(&c->lock);
+    if(c->state != UNUSED && strncmp(c->name, cname, sizeof(c->name)) == 0){
+      c->weight = weight;
+      release(&c->lock);
+      return 0;
+    }
+    release(&c->lock);
+  }
+
+  return -1;
+}
@@ -26,6 +26,14 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  int online;                 // Has this cpu entered scheduler()?
+
+  // lock must be held when using these:
+  struct spinlock lock;
+  struct list run_list[NCONT]; // RUNNABLE procs queued on this cpu,
+                               // one FIFO list per container slot.
+  int nrun;                    // Number of procs on the run lists.
+  uint64 nsteal;               // Procs this cpu stole from other cpus.
 };
 
 extern struct cpu cpus[NCPU];
@@ -81,6 +89,16 @@ struct trapframe {
   /* 280 */ uint64 t6;
 };
 
+// A file mapped by mmap().
+struct vma {
+  uint64 addr;                 // Page-aligned start, or 0 if unused
+  uint64 len;                  // Bytes, a multiple of PGSIZE
+  int prot;                    // PROT_ bits
+  int flags;                   // MAP_SHARED or MAP_PRIVATE
+  struct file *f;              // The mapped file
+  uint off;                    // File offset mapped at addr
+};
+
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
@@ -104,13 +122,23 @@ struct proc {
   struct trapframe *trapframe; // data page for trampoline.S
   struct context context;      // swtch() here to run process
   struct file *ofile[NOFILE];  // Open files
+  struct vma vma[NVMA];        // mmap()ed files
+  int nilock;                  // Inode locks held, see mmapfault()
   struct inode *cwd;           // Current directory
+  struct inode *text;          // Program it runs, or 0, see exec()
   char name[16];               // Process name (debugging)
   uint64 nsched;               // Number of times scheduled
   uint64 nticks;               // Number of ticks executed
   struct list_elem elem;       // Linked list pointers
   struct cont *contp;          // Pointer to owening container
   struct list_elem elem_c;     // list_elem for container
+  int cpu;                     // Run queue to use when made RUNNABLE
+  void (*kfn)(void);           // Body of a kernel thread, see kthread()
+
+  // tickslock must be held when using these:
+  uint deadline;               // Tick at which sys_sleep() ends
+  int timerset;                // On the timer wheel?
+  struct list_elem elem_t;     // list_elem for the timer wheel
 };
 
 // Containers
@@ -125,7 +153,8 @@ struct cont {
   struct list_elem elem;       // list_elem for container run list
   struct list proc_list;       // List of process that exist in the container
                                // in any state.
-  struct list run_list;        // List of RUNNABLE processes in the container
+  int nrunnable;               // Number of RUNNABLE processes queued on
+                               // any cpu's run list.
   char name[16];               // Container name
   char rootpath[128];          // Container root directory path
   struct inode *rootdir;       // inode for root directory
@@ -135,4 +164,7 @@ struct cont {
   int used_disk_bytes;         // Keep track of disk bytes used
   int nticks;                  // Keep track of total ticks used by all processes
                                // in the container.
+  int weight;                  // CPU share relative to other containers
+  uint64 pass;                 // Virtual time consumed, advanced by
+                               // STRIDE1/weight for every tick charged.
 };
@@ -0,0 +1,214 @@
+// Slab allocator for small, fixed-size kernel objects.
+//
+// Each cache hands out objects of one size, carved out of
+// page-sized slabs from kalloc(). A slab page starts with a
+// struct slab and is followed by as many objects as fit; free
+// objects are chained through their first word. Slabs with free
+// objects are on the cache's partial list, the others on its full
+// list. At most one completely free slab is kept per cache; the
+// rest go back to kalloc().
+//
+// In front of the slabs each hart has a magazine of up to MAGSIZE
+// free objects. A hart uses its own magazine with interrupts off
+// and without a lock, and refills or flushes it half a magazine
+// at a time under the cache lock.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "list.h"
+#include "defs.h"
+#include "kstats.h"
+
+#define MAGSIZE 16
+
+struct slab {
+  struct list_elem elem;  // On the partial or full list
+  void *freelist;         // Free objects in this slab
+  int nfree;
+};
+
+#define SLABHDR ((sizeof(struct slab) + 7) & ~7)
+
+struct magazine {
+  int n;
+  void *obj[MAGSIZE];
+};
+
+struct slabcache {
+  struct spinlock lock;
+  char *name;
+  uint size;            // Object size
+  int perslab;          // Objects per slab
+  struct list partial;  // Slabs with free objects
+  struct list full;     // Slabs with none
+  int nslab;            // Slab pages held
+  int nempty;           // Slabs with every object free
+  int nout;             // Objects outside the slabs
+  struct magazine mag[NCPU];
+};
+
+struct slabcache slabcache[NSLAB];
+int nslabcache;
+
+// Create a cache of objects of the given size. Only called
+// during boot.
+struct slabcache*
+slabcreate(char *name, uint size)
+{
+  struct slabcache *c;
+
+  size = (size + 7) & ~7;
+  if(SLABHDR + size > PGSIZE)
+    panic("slabcreate: size");
+  if(nslabcache == NSLAB)
+    panic("slabcreate: too many caches");
+
+  c = &slabcache[nslabcache++];
+  initlock(&c->lock, "slab");
+  c->name = name;
+  c->size = size;
+  c->perslab = (PGSIZE - SLABHDR) / size;
+  list_init(&c->partial);
+  list_init(&c->full);
+  return c;
+}
+
+// Take an object out of the slabs, allocating a new slab if
+// none has a free object. Caller must hold c->lock, which is
+// released around kalloc(): when memory runs out, kalloc() asks
+// the buffer and page caches to give some back, and they free
+// their objects with slabfree(), perhaps to this very cache.
+static void*
+slabget(struct slabcache *c)
+{
+  struct slab *s;
+  char *obj;
+
+  if(list_empty(&c->partial)){
+    release(&c->lock);
+    s = kalloc();
+    acquire(&c->lock);
+    if(s == 0)
+      return 0;
+    s->freelist = 0;
+    s->nfree = c->perslab;
+    for(int i = c->perslab - 1; i >= 0; i--){
+      obj = (char*)s + SLABHDR + i * c->size;
+      *(void**)obj = s->freelist;
+      s->freelist = obj;
+    }
+    list_push_front(&c->partial, &s->elem);
+    c->nslab++;
+    c->nempty++;
+  }
+
+  s = list_entry(list_front(&c->partial), struct slab, elem);
+  if(s->nfree == c->perslab)
+    c->nempty--;
+  obj = s->freelist;
+  s->freelist = *(void**)obj;
+  s->nfree--;
+  if(s->nfree == 0){
+    list_remove(&s->elem);
+    list_push_back(&c->full, &s->elem);
+  }
+  c->nout++;
+  return obj;
+}
+
+// Put an object back in its slab. Caller must hold c->lock.
+static void
+slabput(struct slabcache *c, void *obj)
+{
+  struct slab *s;
+
+  s = (struct slab*)PGROUNDDOWN((uint64)obj);
+  if(s->nfree == 0){
+    list_remove(&s->elem);
+    list_push_front(&c->partial, &s->elem);
+  }
+  *(void**)obj = s->freelist;
+  s->freelist = obj;
+  s->nfree++;
+  c->nout--;
+
+  if(s->nfree == c->perslab){
+    if(c->nempty > 0){
+      list_remove(&s->elem);
+      c->nslab--;
+      kfree(s);
+    } else {
+      c->nempty++;
+    }
+  }
+}
+
+// Allocate an object from c. The contents are undefined.
+// Returns 0 if the memory cannot be allocated.
+void*
+slaballoc(struct slabcache *c)
+{
+  struct magazine *m;
+  void *obj;
+
+  push_off();
+  m = &c->mag[cpuid()];
+  if(m->n == 0){
+    acquire(&c->lock);
+    while(m->n < MAGSIZE / 2 && (obj = slabget(c)) != 0){
+      // slabget() may have let slabfree() refill m.
+      if(m->n == MAGSIZE){
+        slabput(c, obj);
+        break;
+      }
+      m->obj[m->n++] = obj;
+    }
+    release(&c->lock);
+  }
+  obj = 0;
+  if(m->n > 0)
+    obj = m->obj[--m->n];
+  pop_off();
+  return obj;
+}
+
+// Free an object allocated from c.
+void
+slabfree(struct slabcache *c, void *obj)
+{
+  struct magazine *m;
+
+  push_off();
+  m = &c->mag[cpuid()];
+  if(m->n == MAGSIZE){
+    acquire(&c->lock);
+    while(m->n > MAGSIZE / 2)
+      slabput(c, m->obj[--m->n]);
+    release(&c->lock);
+  }
+  m->obj[m->n++] = obj;
+  pop_off();
+}
+
+// Fill in the slab section of ks.
+void
+slabstats(struct kstats *ks)
+{
+  struct slabcache *c;
+  int i, ncached;
+
+  for(i = 0; i < nslabcache; i++){
+    c = &slabcache[i];
+    ncached = 0;
+    for(int j = 0; j < NCPU; j++)
+      ncached += c->mag[j].n;
+    safestrcpy(ks->slab[i].name, c->name, sizeof(ks->slab[i].name));
+    ks->slab[i].size = c->size;
+    ks->slab[i].nslab = c->nslab;
+    ks->slab[i].ninuse = c->nout - ncached;
+    ks->slab[i].ncached = ncached;
+  }
+}
@@ -5,5 +5,9 @@ struct spinlock {
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
+
+  // Statistics, updated while holding the lock:
+  uint64 nacquire;   // Number of acquisitions.
+  uint64 ncontend;   // Acquisitions that found the lock held.
 };
 
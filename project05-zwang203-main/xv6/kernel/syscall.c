@@ -107,6 +107,11 @@ extern uint64 sys_sproc(void);
 extern uint64 sys_consw(void);
 extern uint64 sys_cfork(void);
 extern uint64 sys_cinfo(void);
+extern uint64 sys_cweight(void);
+extern uint64 sys_kstats(void);
+extern uint64 sys_kpages(void);
+extern uint64 sys_mmap(void);
+extern uint64 sys_munmap(void);
 
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
@@ -138,6 +143,11 @@ static uint64 (*syscalls[])(void) = {
 [SYS_consw]   sys_consw,
 [SYS_cfork]   sys_cfork,
 [SYS_cinfo]   sys_cinfo,
+[SYS_cweight] sys_cweight,
+[SYS_kstats]  sys_kstats,
+[SYS_kpages]  sys_kpages,
+[SYS_mmap]    sys_mmap,
+[SYS_munmap]  sys_munmap,
 };
 
 void
@@ -27,3 +27,8 @@
 #define SYS_consw  26
 #define SYS_cfork  27
 #define SYS_cinfo  28
+#define SYS_cweight 29
+#define SYS_kstats 30
+#define SYS_kpages 31
+#define SYS_mmap   32
+#define SYS_munmap 33
@@ -189,7 +189,6 @@ uint64
 sys_unlink(void)
 {
   struct inode *ip, *dp;
-  struct dirent de;
   char name[DIRSIZ], path[MAXPATH];
   uint off;
 
@@ -219,9 +218,7 @@ sys_unlink(void)
     goto bad;
   }
 
-  memset(&de, 0, sizeof(de));
-  if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-    panic("unlink: writei");
+  dirunlink(dp, name, off);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -305,7 +302,7 @@ uint64
 sys_open(void)
 {
   char path[MAXPATH];
-  int fd, omode;
+  int fd, omode, writer;
   struct file *f;
   struct inode *ip;
   int n;
@@ -341,9 +338,19 @@ sys_open(void)
     return -1;
   }
 
+  // A file that a process is running cannot be written.
+  writer = ip->type == T_FILE && ((omode & O_WRONLY) || (omode & O_RDWR));
+  if(writer && iwriteget(ip) < 0){
+    iunlockput(ip);
+    end_op();
+    return -1;
+  }
+
   if((f = filealloc()) == 0 || (fd = fdalloc(f)) < 0){
     if(f)
       fileclose(f);
+    if(writer)
+      iwriteput(ip);
     iunlockput(ip);
     end_op();
     return -1;
@@ -518,3 +525,33 @@ sys_pipec(void)
     
   return pipecount(f->pipe);
 }
+
+uint64
+sys_mmap(void)
+{
+  struct file *f;
+  uint64 addr;
+  int len, prot, flags, off;
+
+  argaddr(0, &addr);  // a hint, which is ignored
+  argint(1, &len);
+  argint(2, &prot);
+  argint(3, &flags);
+  argint(5, &off);
+  if(argfd(4, 0, &f) < 0 || len <= 0 || off < 0)
+    return -1;
+  return mmap(len, prot, flags, f, off);
+}
+
+uint64
+sys_munmap(void)
+{
+  uint64 addr;
+  int len;
+
+  argaddr(0, &addr);
+  argint(1, &len);
+  if(len <= 0)
+    return -1;
+  return munmap(addr, len);
+}
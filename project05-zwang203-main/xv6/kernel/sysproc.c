@@ -5,6 +5,7 @@
 #include "memlayout.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "kstats.h"
 
 uint64
 sys_exit(void)
@@ -53,17 +54,25 @@ sys_sleep(void)
 {
   int n;
   uint ticks0;
+  struct proc *p = myproc();
 
   argint(0, &n);
   acquire(&tickslock);
   ticks0 = ticks;
+  if(n == 0){
+    release(&tickslock);
+    return 0;
+  }
+  timer_add(p, ticks0 + n);
   while(ticks - ticks0 < n){
-    if(killed(myproc())){
+    if(killed(p)){
+      timer_cancel(p);
       release(&tickslock);
       return -1;
     }
-    sleep(&ticks, &tickslock);
+    sleep(&p->deadline, &tickslock);
   }
+  timer_done(p);
   release(&tickslock);
   return 0;
 }
@@ -159,3 +168,49 @@ sys_cinfo(void)
   argaddr(0, &up_p);
   return cinfo(up_p);
 }
+
+uint64
+sys_cweight(void)
+{
+  char cname[16];
+  int weight;
+
+  if(argstr(0, cname, 16) < 0)
+    return -1;
+
+  argint(1, &weight);
+
+  return cweight(cname, weight);
+}
+
+// return the number of free physical pages.
+uint64
+sys_kpages(void)
+{
+  return kpages();
+}
+
+uint64
+sys_kstats(void)
+{
+  uint64 ks_p;  // user pointer to struct kstats
+  struct kstats ks;
+
+  argaddr(0, &ks_p);
+  memset(&ks, 0, sizeof(ks));
+  timerstats(&ks);
+  kallocstats(&ks);
+  slabstats(&ks);
+  bstats(&ks);
+  virtio_disk_stats(&ks);
+  logstats(&ks);
+  fsstats(&ks);
+  istats(&ks);
+  dcstats(&ks);
+  pcstats(&ks);
+  mmapstats(&ks);
+  execstats(&ks);
+  if(copyout(myproc()->pagetable, ks_p, (char *)&ks, sizeof(ks)) < 0)
+    return -1;
+  return 0;
+}
@@ -5,10 +5,25 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "defs.h"
+#include "kstats.h"
 
 struct spinlock tickslock;
 uint ticks;
 
+// Timer wheel for sys_sleep(). A sleeping process is kept in the slot
+// for its deadline modulo NTIMERSLOT and clockintr() only examines the
+// slot for the current tick, so each sleeper is woken exactly once, at
+// its deadline, instead of on every tick.
+// tickslock must be held when using these.
+#define NTIMERSLOT 64
+
+struct list timerwheel[NTIMERSLOT];
+int ntimers;               // Processes on the wheel
+uint64 timer_fired;
+uint64 timer_avoided;
+uint64 timer_lat_sum;
+uint64 timer_lat_max;
+
 extern char trampoline[], uservec[], userret[];
 
 // in kernelvec.S, calls kerneltrap().
@@ -20,6 +35,55 @@ void
 trapinit(void)
 {
   initlock(&tickslock, "time");
+  for(int i = 0; i < NTIMERSLOT; i++)
+    list_init(&timerwheel[i]);
+}
+
+// Arrange for p to be woken up on &p->deadline at tick deadline.
+// Caller must hold tickslock.
+void
+timer_add(struct proc *p, uint deadline)
+{
+  p->deadline = deadline;
+  p->timerset = 1;
+  list_push_back(&timerwheel[deadline % NTIMERSLOT], &p->elem_t);
+  ntimers += 1;
+}
+
+// Take p off the timer wheel if its deadline has not expired yet,
+// e.g. because it was killed while sleeping.
+// Caller must hold tickslock.
+void
+timer_cancel(struct proc *p)
+{
+  if(p->timerset){
+    list_remove(&p->elem_t);
+    p->timerset = 0;
+    ntimers -= 1;
+  }
+}
+
+// Record how late p started running after its deadline expired.
+// Caller must hold tickslock.
+void
+timer_done(struct proc *p)
+{
+  uint64 lat = ticks - p->deadline;
+
+  timer_lat_sum += lat;
+  if(lat > timer_lat_max)
+    timer_lat_max = lat;
+}
+
+void
+timerstats(struct kstats *ks)
+{
+  acquire(&tickslock);
+  ks->timer_fired = timer_fired;
+  ks->timer_avoided = timer_avoided;
+  ks->timer_lat_sum = timer_lat_sum;
+  ks->timer_lat_max = timer_lat_max;
+  release(&tickslock);
 }
 
 // set up to take exceptions and traps while in the kernel.
@@ -65,6 +129,14 @@ usertrap(void)
     intr_on();
 
     syscall();
+  } else if(r_scause() == 15 && uvmcow(p->pagetable, r_stval()) == 0){
+    // store to a copy-on-write page; it is now private and writable.
+  } else if((r_scause() == 13 || r_scause() == 15) &&
+            uvmlazy(p->pagetable, r_stval(), p->sz) == 0){
+    // first touch of a heap page reserved by sbrk().
+  } else if((r_scause() == 12 || r_scause() == 13 || r_scause() == 15) &&
+            mmapfault(p, r_stval(), r_scause() == 15) == 0){
+    // page of an mmap()ed file.
   } else if((which_dev = devintr()) != 0){
     // ok
   } else {
@@ -78,8 +150,7 @@ usertrap(void)
 
   // give up the CPU if this is a timer interrupt.
   if(which_dev == 2) {
-    p->nticks += 1;
-    p->contp->nticks += 1;
+    proctick(p);
     yield();
   }
   
@@ -156,8 +227,7 @@ kerneltrap()
   // give up the CPU if this is a timer interrupt.
 
   if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING) {
-    myproc()->nticks += 1;
-    myproc()->contp->nticks += 1;
+    proctick(myproc());
     yield();
   }
   
@@ -170,9 +240,30 @@ kerneltrap()
 void
 clockintr()
 {
+  struct list *slot;
+  struct list_elem *e, *next;
+  struct proc *p;
+
   acquire(&tickslock);
   ticks++;
   wakeup(&ticks);
+
+  // Wake the sleepers whose deadline is this tick. Sleepers in the
+  // same slot with a later deadline stay where they are.
+  slot = &timerwheel[ticks % NTIMERSLOT];
+  for(e = list_begin(slot); e != list_end(slot); e = next){
+    next = list_next(e);
+    p = list_entry(e, struct proc, elem_t);
+    if(p->deadline != ticks)
+      continue;
+    timer_cancel(p);
+    timer_fired += 1;
+    wakeup(&p->deadline);
+  }
+
+  // Every sleeper still on the wheel would have been woken
+  // here just to go back to sleep.
+  timer_avoided += ntimers;
   release(&tickslock);
 }
 
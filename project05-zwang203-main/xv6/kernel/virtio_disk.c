@@ -15,6 +15,7 @@
 #include "fs.h"
 #include "buf.h"
 #include "virtio.h"
+#include "kstats.h"
 
 // the address of virtio mmio register r.
 #define R(r) ((volatile uint32 *)(VIRTIO0 + (r)))
@@ -55,6 +56,12 @@ static struct disk {
   struct virtio_blk_req ops[NUM];
   
   struct spinlock vdisk_lock;
+
+  int inflight;    // requests the device has not finished
+  uint64 nreq;     // requests submitted
+  uint64 nblocks;  // blocks in those requests
+  uint64 nwrite;   // ... of them written
+  uint64 qdepth[NQDEPTH]; // requests submitted at each depth
   
 } disk;
 
@@ -196,12 +203,11 @@ free_chain(int i)
   }
 }
 
-// allocate three descriptors (they need not be contiguous).
-// disk transfers always use three descriptors.
+// allocate n descriptors (they need not be contiguous).
 static int
-alloc3_desc(int *idx)
+alloc_descs(int *idx, int n)
 {
-  for(int i = 0; i < 3; i++){
+  for(int i = 0; i < n; i++){
     idx[i] = alloc_desc();
     if(idx[i] < 0){
       for(int j = 0; j < i; j++)
@@ -212,27 +218,35 @@ alloc3_desc(int *idx)
   return 0;
 }
 
+// Start one request that reads or writes the n buffers in b[],
+// which must hold consecutive blocks of the disk, and return
+// without waiting. virtio_disk_intr() clears each buffer's
+// b->disk when the disk is done, and then calls bdone(b) if
+// b->async is set, or wakes up b.
 void
-virtio_disk_rw(struct buf *b, int write)
+virtio_disk_startv(struct buf **b, int n, int write)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
+  uint64 sector = b[0]->blockno * (BSIZE / 512);
+
+  if(n < 1 || n > NDISKSEG)
+    panic("virtio_disk_startv");
 
   acquire(&disk.vdisk_lock);
 
   // the spec's Section 5.2 says that legacy block operations use
-  // three descriptors: one for type/reserved/sector, one for the
-  // data, one for a 1-byte status result.
+  // a descriptor for type/reserved/sector, descriptors for the
+  // data, and one for a 1-byte status result.
 
-  // allocate the three descriptors.
-  int idx[3];
+  // allocate the n+2 descriptors.
+  int idx[NDISKSEG+2];
   while(1){
-    if(alloc3_desc(idx) == 0) {
+    if(alloc_descs(idx, n+2) == 0) {
       break;
     }
     sleep(&disk.free[0], &disk.vdisk_lock);
   }
 
-  // format the three descriptors.
+  // format the descriptors.
   // qemu's virtio-blk.c reads them.
 
   struct virtio_blk_req *buf0 = &disk.ops[idx[0]];
@@ -249,24 +263,30 @@ virtio_disk_rw(struct buf *b, int write)
   disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
   disk.desc[idx[0]].next = idx[1];
 
-  disk.desc[idx[1]].addr = (uint64) b->data;
-  disk.desc[idx[1]].len = BSIZE;
-  if(write)
-    disk.desc[idx[1]].flags = 0; // device reads b->data
-  else
-    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-  disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk.desc[idx[1]].next = idx[2];
+  for(int i = 0; i < n; i++){
+    disk.desc[idx[1+i]].addr = (uint64) b[i]->data;
+    disk.desc[idx[1+i]].len = BSIZE;
+    if(write)
+      disk.desc[idx[1+i]].flags = 0; // device reads b->data
+    else
+      disk.desc[idx[1+i]].flags = VRING_DESC_F_WRITE; // device writes b->data
+    disk.desc[idx[1+i]].flags |= VRING_DESC_F_NEXT;
+    disk.desc[idx[1+i]].next = idx[2+i];
+  }
 
   disk.info[idx[0]].status = 0xff; // device writes 0 on success
-  disk.desc[idx[2]].addr = (uint64) &disk.info[idx[0]].status;
-  disk.desc[idx[2]].len = 1;
-  disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-  disk.desc[idx[2]].next = 0;
-
-  // record struct buf for virtio_disk_intr().
-  b->disk = 1;
-  disk.info[idx[0]].b = b;
+  disk.desc[idx[n+1]].addr = (uint64) &disk.info[idx[0]].status;
+  disk.desc[idx[n+1]].len = 1;
+  disk.desc[idx[n+1]].flags = VRING_DESC_F_WRITE; // device writes the status
+  disk.desc[idx[n+1]].next = 0;
+
+  // record the struct bufs, chained through qnext,
+  // for virtio_disk_intr().
+  for(int i = 0; i < n; i++){
+    b[i]->disk = 1;
+    b[i]->qnext = i+1 < n ? b[i+1] : 0;
+  }
+  disk.info[idx[0]].b = b[0];
 
   // tell the device the first index in our chain of descriptors.
   disk.avail->ring[disk.avail->idx % NUM] = idx[0];
@@ -280,17 +300,42 @@ virtio_disk_rw(struct buf *b, int write)
 
   *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
 
-  // Wait for virtio_disk_intr() to say request has finished.
+  disk.inflight += 1;
+  disk.nreq += 1;
+  disk.nblocks += n;
+  if(write)
+    disk.nwrite += n;
+  disk.qdepth[(disk.inflight < NQDEPTH ? disk.inflight : NQDEPTH) - 1] += 1;
+
+  release(&disk.vdisk_lock);
+}
+
+// Start a read or write of b and return without waiting.
+void
+virtio_disk_start(struct buf *b, int write)
+{
+  virtio_disk_startv(&b, 1, write);
+}
+
+// Wait for virtio_disk_intr() to say the request for b,
+// which must not be async, has finished.
+void
+virtio_disk_wait(struct buf *b)
+{
+  acquire(&disk.vdisk_lock);
   while(b->disk == 1) {
     sleep(b, &disk.vdisk_lock);
   }
-
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
-
   release(&disk.vdisk_lock);
 }
 
+void
+virtio_disk_rw(struct buf *b, int write)
+{
+  virtio_disk_start(b, write);
+  virtio_disk_wait(b);
+}
+
 void
 virtio_disk_intr()
 {
@@ -317,11 +362,34 @@ virtio_disk_intr()
       panic("virtio_disk_intr status");
 
     struct buf *b = disk.info[id].b;
-    b->disk = 0;   // disk is done with buf
-    wakeup(b);
+    disk.info[id].b = 0;
+    free_chain(id);
+    disk.inflight -= 1;
+    while(b){
+      struct buf *next = b->qnext;
+      b->disk = 0;   // disk is done with buf
+      if(b->async)
+        bdone(b);
+      else
+        wakeup(b);
+      b = next;
+    }
 
     disk.used_idx += 1;
   }
 
   release(&disk.vdisk_lock);
 }
+
+// Fill in the disk section of ks.
+void
+virtio_disk_stats(struct kstats *ks)
+{
+  acquire(&disk.vdisk_lock);
+  ks->disk_nreq = disk.nreq;
+  ks->disk_nblocks = disk.nblocks;
+  ks->disk_nwrite = disk.nwrite;
+  for(int i = 0; i < NQDEPTH; i++)
+    ks->disk_qdepth[i] = disk.qdepth[i];
+  release(&disk.vdisk_lock);
+}
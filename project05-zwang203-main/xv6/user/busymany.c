@@ -40,7 +40,7 @@ main(int argc, char **argv)
   int withsleep = 0;
   int argidx = 1;
   
-  if(argc != 3){
+  if(argc != 3 && argc != 4){
     printf("usage: busy <ticks> [-s] <count>\n");
     printf("  -s uses sleep in busy loop to reduce CPU usage.\n");
     exit(-1);
@@ -30,6 +30,7 @@ main(int argc, char **argv)
       printf("  used_mem_bytes  : %d\n", ci->used_disk_bytes);
       printf("  nprocs          : %d\n", ci->nprocs);
       printf("  nticks          : %d\n", ci->nticks);
+      printf("  weight          : %d\n", ci->weight);
       printf("\n");
     }
   }
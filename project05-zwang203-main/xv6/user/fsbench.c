@@ -0,0 +1,882 @@
+// fsbench - measure file system and buffer cache performance.
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/fs.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/kstats.h"
+#include "user/user.h"
+
+#define MAXCHUNK 64  // most blocks per write() in the write benchmark
+
+char buf[BSIZE];
+char wbuf[MAXCHUNK*BSIZE];
+
+// Create file path with nblocks blocks of data.
+void
+mkfile(char *path, int nblocks)
+{
+  int fd;
+
+  fd = open(path, O_CREATE | O_TRUNC | O_WRONLY);
+  if(fd < 0){
+    printf("fsbench: cannot create %s\n", path);
+    exit(-1);
+  }
+  memset(buf, 'a', sizeof(buf));
+  for(int i = 0; i < nblocks; i++){
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf("fsbench: write %s failed\n", path);
+      exit(-1);
+    }
+  }
+  close(fd);
+}
+
+// Read all of path, rounds times. Returns the number of blocks read.
+int
+readfile(char *path, int rounds)
+{
+  int fd, n, nblocks;
+
+  nblocks = 0;
+  for(int r = 0; r < rounds; r++){
+    fd = open(path, O_RDONLY);
+    if(fd < 0){
+      printf("fsbench: cannot open %s\n", path);
+      exit(-1);
+    }
+    while((n = read(fd, buf, sizeof(buf))) > 0)
+      nblocks++;
+    close(fd);
+  }
+  return nblocks;
+}
+
+// Name of the i'th benchmark file.
+void
+fname(char *path, int i)
+{
+  strcpy(path, "fsb00");
+  path[3] += i / 10;
+  path[4] += i % 10;
+}
+
+// Run nprocs processes that each read their own nblocks-block file
+// rounds times, like stressfs but reading. The files are small
+// enough to stay cached, so almost every bread() is a hit. Boot with
+// make CPUS=1, 2, 4 and 8 to see how cache hits scale with the
+// number of harts.
+void
+parread(int nprocs, int nblocks, int rounds)
+{
+  struct kstats ks0, ks1;
+  char path[8];
+  int start, elapsed, total;
+
+  for(int i = 0; i < nprocs; i++){
+    fname(path, i);
+    mkfile(path, nblocks);
+  }
+  // Warm the cache.
+  for(int i = 0; i < nprocs; i++){
+    fname(path, i);
+    readfile(path, 1);
+  }
+
+  kstats(&ks0);
+  start = uptime();
+  for(int i = 0; i < nprocs; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("fsbench: fork failed\n");
+      exit(-1);
+    }
+    if(pid == 0){
+      fname(path, i);
+      readfile(path, rounds);
+      exit(0);
+    }
+  }
+  for(int i = 0; i < nprocs; i++)
+    wait(0);
+  elapsed = uptime() - start;
+  kstats(&ks1);
+
+  total = nprocs * nblocks * rounds;
+  printf("read: %d procs x %d blocks x %d rounds in %d ticks",
+         nprocs, nblocks, rounds, elapsed);
+  if(elapsed > 0)
+    printf(" (%d blocks/tick)", total / elapsed);
+  printf("\n");
+  printf("  bcache hits %l misses %l\n",
+         ks1.bcache_nhit - ks0.bcache_nhit, ks1.bcache_nmiss - ks0.bcache_nmiss);
+  printf("  bcache locks acquired %l, contended %l\n",
+         ks1.bcache_nacquire - ks0.bcache_nacquire,
+         ks1.bcache_ncontend - ks0.bcache_ncontend);
+
+  for(int i = 0; i < nprocs; i++){
+    fname(path, i);
+    unlink(path);
+  }
+}
+
+// Read a file of nblocks blocks rounds times. With a fixed cache
+// of NBUF blocks, any file larger than that misses on every block
+// of every round.
+void
+reread(int nblocks, int rounds)
+{
+  struct kstats ks0, ks1;
+  int start, elapsed;
+
+  mkfile("fsb00", nblocks);
+
+  kstats(&ks0);
+  start = uptime();
+  readfile("fsb00", rounds);
+  elapsed = uptime() - start;
+  kstats(&ks1);
+
+  printf("reread: %d blocks x %d rounds in %d ticks", nblocks, rounds, elapsed);
+  if(elapsed > 0)
+    printf(" (%d blocks/tick)", nblocks * rounds / elapsed);
+  printf("\n");
+  printf("  bcache hits %l misses %l evictions %l\n",
+         ks1.bcache_nhit - ks0.bcache_nhit, ks1.bcache_nmiss - ks0.bcache_nmiss,
+         ks1.bcache_nevict - ks0.bcache_nevict);
+  printf("  bcache buffers %l\n", ks1.bcache_nbuf);
+
+  unlink("fsb00");
+}
+
+// Print disk requests per tick and the queue depth each request
+// found when it was submitted, between ks0 and ks1.
+void
+diskstats(struct kstats *ks0, struct kstats *ks1, int elapsed)
+{
+  uint64 nreq = ks1->disk_nreq - ks0->disk_nreq;
+
+  printf("  disk requests %l, %l blocks", nreq,
+         ks1->disk_nblocks - ks0->disk_nblocks);
+  if(elapsed > 0)
+    printf(" (%l/tick)", nreq / elapsed);
+  printf(", queue depth");
+  for(int i = 0; i < NQDEPTH; i++)
+    printf(" %l", ks1->disk_qdepth[i] - ks0->disk_qdepth[i]);
+  printf("\n");
+}
+
+// Write a file of nblocks blocks, chunk blocks per write(), the
+// way a large cp (chunk 1) or bigwrite in usertests would.
+void
+seqwrite(int nblocks, int chunk)
+{
+  struct kstats ks0, ks1;
+  int start, elapsed, fd, n;
+  uint64 ncommit;
+
+  if(chunk < 1 || chunk > MAXCHUNK){
+    printf("fsbench: chunk must be 1..%d blocks\n", MAXCHUNK);
+    exit(-1);
+  }
+  memset(wbuf, 'a', sizeof(wbuf));
+
+  kstats(&ks0);
+  start = uptime();
+  fd = open("fsb00", O_CREATE | O_TRUNC | O_WRONLY);
+  if(fd < 0){
+    printf("fsbench: cannot create fsb00\n");
+    exit(-1);
+  }
+  for(int i = 0; i < nblocks; i += chunk){
+    n = (nblocks - i < chunk ? nblocks - i : chunk) * BSIZE;
+    if(write(fd, wbuf, n) != n){
+      printf("fsbench: write fsb00 failed\n");
+      exit(-1);
+    }
+  }
+  close(fd);
+  elapsed = uptime() - start;
+  kstats(&ks1);
+
+  ncommit = ks1.log_ncommit - ks0.log_ncommit;
+  printf("write: %d blocks, %d per write, in %d ticks", nblocks, chunk, elapsed);
+  if(elapsed > 0)
+    printf(" (%d blocks/tick)", nblocks / elapsed);
+  printf("\n");
+  printf("  log commits %l, %l blocks, %l ticks committing\n",
+         ncommit, ks1.log_nblocks - ks0.log_nblocks,
+         ks1.log_nticks - ks0.log_nticks);
+  printf("  log commits per MiB %l, log size %l blocks\n",
+         ncommit * 1024 * 1024 / ((uint64)nblocks * BSIZE), ks1.log_size);
+  diskstats(&ks0, &ks1, elapsed);
+
+  unlink("fsb00");
+}
+
+// Run nprocs processes that each create, write one block to and
+// delete nfiles files, like createdelete in usertests. Every
+// create and unlink is an FS system call of its own, so this
+// shows how many of them the log commits as one group. With
+// shared set, all processes use the same file name, like
+// concreate.
+void
+ops(int nprocs, int nfiles, int shared)
+{
+  struct kstats ks0, ks1;
+  char path[8];
+  int start, elapsed;
+  uint64 nop, ncommit;
+
+  kstats(&ks0);
+  start = uptime();
+  for(int i = 0; i < nprocs; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("fsbench: fork failed\n");
+      exit(-1);
+    }
+    if(pid == 0){
+      fname(path, shared ? 0 : i);
+      for(int j = 0; j < nfiles; j++){
+        mkfile(path, 1);
+        unlink(path);
+      }
+      exit(0);
+    }
+  }
+  for(int i = 0; i < nprocs; i++)
+    wait(0);
+  elapsed = uptime() - start;
+  kstats(&ks1);
+
+  nop = ks1.log_nop - ks0.log_nop;
+  ncommit = ks1.log_ncommit - ks0.log_ncommit;
+  printf("%s: %d procs x %d files, %l FS calls in %d ticks",
+         shared ? "concreate" : "ops", nprocs, nfiles, nop, elapsed);
+  if(elapsed > 0)
+    printf(" (%l/tick)", nop / elapsed);
+  printf("\n");
+  printf("  log commits %l", ncommit);
+  if(ncommit > 0)
+    printf(" (%l calls/commit, %l blocks/commit)", nop / ncommit,
+           (ks1.log_nblocks - ks0.log_nblocks) / ncommit);
+  printf(", %l ticks committing\n", ks1.log_nticks - ks0.log_nticks);
+  printf("  log checkpoints %l, %l blocks installed\n",
+         ks1.log_nckpt - ks0.log_nckpt,
+         ks1.log_nckptblocks - ks0.log_nckptblocks);
+  if(nop > 0)
+    printf("  disk blocks written per 100 FS calls %l\n",
+           (ks1.disk_nwrite - ks0.disk_nwrite) * 100 / nop);
+  diskstats(&ks0, &ks1, elapsed);
+}
+
+// Write a file of mb MiB, MAXCHUNK blocks per write(), then read
+// it back, like bigfile in usertests but larger than the old
+// single-indirect limit of 268 blocks. Blocks allocated in order
+// sit next to each other on the disk, so both directions should
+// go out in multi-block requests.
+void
+bigfile(int mb)
+{
+  struct kstats ks0, ks1, ks2;
+  int fd, start, welapsed, relapsed, nblocks, n;
+
+  nblocks = mb * 1024 * 1024 / BSIZE;
+  memset(wbuf, 'b', sizeof(wbuf));
+
+  kstats(&ks0);
+  start = uptime();
+  fd = open("fsb00", O_CREATE | O_TRUNC | O_WRONLY);
+  if(fd < 0){
+    printf("fsbench: cannot create fsb00\n");
+    exit(-1);
+  }
+  for(int i = 0; i < nblocks; i += MAXCHUNK){
+    n = (nblocks - i < MAXCHUNK ? nblocks - i : MAXCHUNK) * BSIZE;
+    if(write(fd, wbuf, n) != n){
+      printf("fsbench: write fsb00 failed at block %d\n", i);
+      exit(-1);
+    }
+  }
+  close(fd);
+  welapsed = uptime() - start;
+  kstats(&ks1);
+
+  start = uptime();
+  fd = open("fsb00", O_RDONLY);
+  while((n = read(fd, wbuf, sizeof(wbuf))) > 0)
+    ;
+  close(fd);
+  relapsed = uptime() - start;
+  kstats(&ks2);
+
+  printf("big: %d MiB written in %d ticks", mb, welapsed);
+  if(welapsed > 0)
+    printf(" (%d KiB/tick)", mb * 1024 / welapsed);
+  printf(", read in %d ticks", relapsed);
+  if(relapsed > 0)
+    printf(" (%d KiB/tick)", mb * 1024 / relapsed);
+  printf("\n");
+  printf("  write:");
+  diskstats(&ks0, &ks1, welapsed);
+  printf("  read:");
+  diskstats(&ks1, &ks2, relapsed);
+
+  unlink("fsb00");
+}
+
+// Fill the file system until pct percent of its blocks are in use,
+// then time creating nfiles one-block files, and report how many
+// bitmap and inode blocks the allocators read to do it.
+void
+full(int pct, int nfiles)
+{
+  struct kstats ks0, ks1;
+  char path[8];
+  int fd, start, elapsed, nfill, n;
+  uint64 want;
+
+  kstats(&ks0);
+  want = ks0.fs_size * pct / 100;
+  memset(wbuf, 'f', sizeof(wbuf));
+  strcpy(path, "fill0");
+  for(nfill = 0; nfill < 10; nfill++){
+    kstats(&ks1);
+    if(ks1.fs_size - ks1.fs_nfree >= want)
+      break;
+    path[4] = '0' + nfill;
+    fd = open(path, O_CREATE | O_TRUNC | O_WRONLY);
+    if(fd < 0){
+      printf("fsbench: cannot create %s\n", path);
+      exit(-1);
+    }
+    // Stop short of MAXFILE and of the fill target.
+    for(int i = 0; i + MAXCHUNK < MAXFILE; i += MAXCHUNK){
+      if(i % (16 * MAXCHUNK) == 0){
+        kstats(&ks1);
+        if(ks1.fs_size - ks1.fs_nfree >= want)
+          break;
+      }
+      if(write(fd, wbuf, sizeof(wbuf)) != sizeof(wbuf))
+        break;
+    }
+    close(fd);
+  }
+
+  kstats(&ks0);
+  start = uptime();
+  for(int i = 0; i < nfiles; i++){
+    fname(path, i % 100);
+    mkfile(path, 1);
+  }
+  elapsed = uptime() - start;
+  kstats(&ks1);
+
+  printf("full: %l%% in use, %d files created in %d ticks",
+         (ks0.fs_size - ks0.fs_nfree) * 100 / ks0.fs_size, nfiles, elapsed);
+  if(elapsed > 0)
+    printf(" (%d files/tick)", nfiles / elapsed);
+  printf("\n");
+  n = ks1.fs_nballoc - ks0.fs_nballoc;
+  printf("  balloc %d, %l bitmap blocks read\n", n, ks1.fs_nbscan - ks0.fs_nbscan);
+  n = ks1.fs_nialloc - ks0.fs_nialloc;
+  printf("  ialloc %d, %l inode blocks read\n", n, ks1.fs_niscan - ks0.fs_niscan);
+
+  for(int i = 0; i < nfiles && i < 100; i++){
+    fname(path, i);
+    unlink(path);
+  }
+  strcpy(path, "fill0");
+  for(int i = 0; i < nfill; i++){
+    path[4] = '0' + i;
+    unlink(path);
+  }
+}
+
+// Open and close each of nfiles files rounds times. Once nothing
+// holds an inode, only the inode cache keeps ilock() from reading
+// it from the disk again on the next open.
+void
+openclose(int nfiles, int rounds)
+{
+  struct kstats ks0, ks1;
+  char path[8];
+  int fd, start, elapsed;
+  uint64 nget;
+
+  for(int i = 0; i < nfiles; i++){
+    fname(path, i);
+    mkfile(path, 0);
+  }
+
+  kstats(&ks0);
+  start = uptime();
+  for(int r = 0; r < rounds; r++){
+    for(int i = 0; i < nfiles; i++){
+      fname(path, i);
+      if((fd = open(path, O_RDONLY)) < 0){
+        printf("fsbench: cannot open %s\n", path);
+        exit(-1);
+      }
+      close(fd);
+    }
+  }
+  elapsed = uptime() - start;
+  kstats(&ks1);
+
+  printf("open: %d files x %d rounds in %d ticks", nfiles, rounds, elapsed);
+  if(elapsed > 0)
+    printf(" (%d opens/tick)", nfiles * rounds / elapsed);
+  printf("\n");
+  nget = (ks1.inode_nhit - ks0.inode_nhit) + (ks1.inode_nmiss - ks0.inode_nmiss);
+  printf("  iget hits %l, misses %l", ks1.inode_nhit - ks0.inode_nhit,
+         ks1.inode_nmiss - ks0.inode_nmiss);
+  if(nget > 0)
+    printf(" (%l%% hit)", (ks1.inode_nhit - ks0.inode_nhit) * 100 / nget);
+  printf(", ilock disk reads %l\n", ks1.inode_nread - ks0.inode_nread);
+
+  for(int i = 0; i < nfiles; i++){
+    fname(path, i);
+    unlink(path);
+  }
+}
+
+// Path of the i'th link in the directory benchmark.
+void
+lname(char *path, int i)
+{
+  strcpy(path, "fsbdir/l00000");
+  for(int k = 12; k >= 8; k--, i /= 10)
+    path[k] += i % 10;
+}
+
+// Make n hard links to one file in a fresh directory, open each
+// of them, then unlink them all. There are more names than the
+// dcache holds, so the lookups search the directory itself; with
+// the directory index each one reads a single dirent.
+void
+dirbench(int n)
+{
+  struct kstats ks0, ks1;
+  char path[16];
+  int fd, t0, t1, t2, t3;
+
+  if(mkdir("fsbdir") < 0 || (fd = open("fsbdir/f", O_CREATE | O_WRONLY)) < 0){
+    printf("fsbench: cannot create fsbdir/f\n");
+    exit(-1);
+  }
+  close(fd);
+
+  kstats(&ks0);
+  t0 = uptime();
+  for(int i = 0; i < n; i++){
+    lname(path, i);
+    if(link("fsbdir/f", path) < 0){
+      printf("fsbench: link %s failed\n", path);
+      exit(-1);
+    }
+  }
+  t1 = uptime();
+  for(int i = 0; i < n; i++){
+    lname(path, i);
+    if((fd = open(path, O_RDONLY)) < 0){
+      printf("fsbench: cannot open %s\n", path);
+      exit(-1);
+    }
+    close(fd);
+  }
+  t2 = uptime();
+  for(int i = 0; i < n; i++){
+    lname(path, i);
+    unlink(path);
+  }
+  t3 = uptime();
+  kstats(&ks1);
+  unlink("fsbdir/f");
+  unlink("fsbdir");
+
+  printf("dir: %d names, link %d ticks, open %d ticks, unlink %d ticks\n",
+         n, t1 - t0, t2 - t1, t3 - t2);
+  printf("  indexes built %l, dirents probed %l, dcache misses %l\n",
+         ks1.fs_ndxbuild - ks0.fs_ndxbuild, ks1.fs_ndxprobe - ks0.fs_ndxprobe,
+         ks1.dc_nmiss - ks0.dc_nmiss);
+}
+
+// Running totals for scan(), which is wc and grep -c in one.
+struct counts {
+  int nline, nword, nchar;
+  int nmatch;     // lines containing the pattern
+  int inword;
+  int j;          // characters of the pattern matched so far
+  int matched;    // this line has matched
+};
+
+// Count the lines, words and characters of the n bytes at s, and
+// the lines that contain pat, continuing from c. pat must not
+// overlap itself, which keeps the matcher this simple.
+void
+scan(char *s, int n, char *pat, struct counts *c)
+{
+  for(int i = 0; i < n; i++){
+    char ch = s[i];
+    c->nchar++;
+    if(ch == '\n'){
+      c->nline++;
+      if(c->matched)
+        c->nmatch++;
+      c->matched = 0;
+      c->j = 0;
+    }
+    if(strchr(" \r\t\n\v", ch))
+      c->inword = 0;
+    else if(!c->inword){
+      c->nword++;
+      c->inword = 1;
+    }
+    if(ch == pat[c->j])
+      c->j++;
+    else
+      c->j = ch == pat[0];
+    if(pat[c->j] == 0){
+      c->matched = 1;
+      c->j = 0;
+    }
+  }
+}
+
+// Scan path rounds times with read(), then rounds times through
+// mmap(), and compare. The reads copy every block out of the
+// buffer cache; the mappings share the page cache's pages, so
+// after the first round they cost one page fault per page.
+void
+mmapscan(char *path, int mb, int rounds)
+{
+  static char line[] = "the quick brown fox jumps over the lazy dog\n";
+  struct kstats ks0, ks1, ks2;
+  struct counts rc, mc;
+  struct stat st;
+  int fd, n, t0, t1, t2;
+  char *a;
+
+  if(path == 0){
+    path = "fsb00";
+    fd = open(path, O_CREATE | O_TRUNC | O_WRONLY);
+    if(fd < 0){
+      printf("fsbench: cannot create %s\n", path);
+      exit(-1);
+    }
+    for(n = 0; n + sizeof(line) - 1 <= sizeof(wbuf); n += sizeof(line) - 1)
+      memmove(wbuf + n, line, sizeof(line) - 1);
+    for(int i = 0; i < mb * 1024 * 1024 / n; i++){
+      if(write(fd, wbuf, n) != n){
+        printf("fsbench: write %s failed\n", path);
+        exit(-1);
+      }
+    }
+    close(fd);
+  }
+  if((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0){
+    printf("fsbench: cannot open %s\n", path);
+    exit(-1);
+  }
+
+  kstats(&ks0);
+  t0 = uptime();
+  for(int r = 0; r < rounds; r++){
+    memset(&rc, 0, sizeof(rc));
+    int rfd = open(path, O_RDONLY);
+    while((n = read(rfd, wbuf, sizeof(wbuf))) > 0)
+      scan(wbuf, n, "lazy", &rc);
+    close(rfd);
+  }
+  t1 = uptime();
+  kstats(&ks1);
+  for(int r = 0; r < rounds; r++){
+    memset(&mc, 0, sizeof(mc));
+    if((a = mmap(0, st.size, PROT_READ, MAP_PRIVATE, fd, 0)) == (char*)-1){
+      printf("fsbench: mmap %s failed\n", path);
+      exit(-1);
+    }
+    scan(a, st.size, "lazy", &mc);
+    munmap(a, st.size);
+  }
+  t2 = uptime();
+  kstats(&ks2);
+  close(fd);
+
+  printf("mmap: %s, %l bytes, %l lines, %l words, %l lines match\n",
+         path, (uint64)mc.nchar, (uint64)mc.nline, (uint64)mc.nword,
+         (uint64)mc.nmatch);
+  if(rc.nchar != mc.nchar || rc.nline != mc.nline || rc.nword != mc.nword ||
+     rc.nmatch != mc.nmatch)
+    printf("  MISMATCH: read() counted %d bytes, %d lines, %d words, %d matches\n",
+           rc.nchar, rc.nline, rc.nword, rc.nmatch);
+  printf("  read() x %d in %d ticks, bcache hits %l, misses %l\n",
+         rounds, t1 - t0, ks1.bcache_nhit - ks0.bcache_nhit,
+         ks1.bcache_nmiss - ks0.bcache_nmiss);
+  printf("  mmap() x %d in %d ticks, page faults %l, pcache hits %l, misses %l\n",
+         rounds, t2 - t1, ks2.mmap_nfault - ks1.mmap_nfault,
+         ks2.pc_nhit - ks1.pc_nhit, ks2.pc_nmiss - ks1.pc_nmiss);
+
+  if(strcmp(path, "fsb00") == 0)
+    unlink(path);
+}
+
+// Print the hit rates of the buffer and page caches between
+// ks0 and ks1.
+void
+cachestats(struct kstats *ks0, struct kstats *ks1)
+{
+  uint64 bhit = ks1->bcache_nhit - ks0->bcache_nhit;
+  uint64 bmiss = ks1->bcache_nmiss - ks0->bcache_nmiss;
+  uint64 phit = ks1->pc_nhit - ks0->pc_nhit;
+  uint64 pmiss = ks1->pc_nmiss - ks0->pc_nmiss;
+
+  printf("  bcache hits %l, misses %l", bhit, bmiss);
+  if(bhit + bmiss > 0)
+    printf(" (%l%% hit)", bhit * 100 / (bhit + bmiss));
+  printf("; pcache hits %l, misses %l", phit, pmiss);
+  if(phit + pmiss > 0)
+    printf(" (%l%% hit)", phit * 100 / (phit + pmiss));
+  printf(", read ahead %l\n", ks1->pc_nra - ks0->pc_nra);
+}
+
+// Open and stat nfiles small files, read a file of mb MiB from
+// one end to the other, then open and stat the small files again.
+// File data goes to the page cache, so the second round should
+// find the inode and directory blocks still in the buffer cache.
+void
+scanmeta(int mb, int nfiles)
+{
+  struct kstats ks0, ks1, ks2, ks3;
+  struct stat st;
+  char path[8];
+  int fd, t0, t1;
+
+  for(int i = 1; i <= nfiles; i++){
+    fname(path, i);
+    mkfile(path, 1);
+  }
+  mkfile("fsb00", mb * 1024 * 1024 / BSIZE);
+
+  kstats(&ks0);
+  for(int i = 1; i <= nfiles; i++){
+    fname(path, i);
+    if(stat(path, &st) < 0){
+      printf("fsbench: cannot stat %s\n", path);
+      exit(-1);
+    }
+  }
+  kstats(&ks1);
+  t0 = uptime();
+  fd = open("fsb00", O_RDONLY);
+  while(read(fd, wbuf, sizeof(wbuf)) > 0)
+    ;
+  close(fd);
+  t1 = uptime();
+  kstats(&ks2);
+  for(int i = 1; i <= nfiles; i++){
+    fname(path, i);
+    stat(path, &st);
+  }
+  kstats(&ks3);
+
+  printf("scan: %d small files, %d MiB read in %d ticks\n", nfiles, mb, t1 - t0);
+  printf("  stat before:");
+  cachestats(&ks0, &ks1);
+  printf("  read:");
+  cachestats(&ks1, &ks2);
+  printf("  stat after:");
+  cachestats(&ks2, &ks3);
+
+  for(int i = 0; i <= nfiles; i++){
+    fname(path, i);
+    unlink(path);
+  }
+}
+
+// Read path once, like cat. Run it right after boot, before
+// anything else has read path, to measure reads from the disk.
+void
+seqread(char *path)
+{
+  struct kstats ks0, ks1;
+  int start, elapsed, nblocks;
+
+  kstats(&ks0);
+  start = uptime();
+  nblocks = readfile(path, 1);
+  elapsed = uptime() - start;
+  kstats(&ks1);
+
+  printf("cat: %s, %d blocks in %d ticks", path, nblocks, elapsed);
+  if(elapsed > 0)
+    printf(" (%d blocks/tick)", nblocks / elapsed);
+  printf("\n");
+  cachestats(&ks0, &ks1);
+  diskstats(&ks0, &ks1, elapsed);
+}
+
+// Time n fork+exec's of path with the argument -h. The first one
+// reads path from the disk if nothing has yet; the rest hit the
+// cache. Also report how path lookups went, since every exec
+// starts with one.
+void
+exectime(char *path, int n)
+{
+  char *argv[] = { path, "-h", 0 };
+  struct kstats ks0, ks1;
+  int start, first, elapsed;
+  uint64 nnamei, nlookup;
+
+  first = 0;
+  kstats(&ks0);
+  start = uptime();
+  for(int i = 0; i < n; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("fsbench: fork failed\n");
+      exit(-1);
+    }
+    if(pid == 0){
+      close(1);
+      close(2);
+      exec(path, argv);
+      exit(-1);
+    }
+    wait(0);
+    if(i == 0)
+      first = uptime() - start;
+  }
+  elapsed = uptime() - start;
+  kstats(&ks1);
+
+  printf("exec: %s first in %d ticks, %d in %d ticks\n",
+         path, first, n, elapsed);
+  nnamei = ks1.fs_nnamei - ks0.fs_nnamei;
+  printf("  path lookups %l", nnamei);
+  if(nnamei > 0)
+    printf(", %l cycles each", (ks1.fs_nameitime - ks0.fs_nameitime) / nnamei);
+  printf("\n");
+  nlookup = (ks1.dc_nhit - ks0.dc_nhit) + (ks1.dc_nneg - ks0.dc_nneg) +
+            (ks1.dc_nmiss - ks0.dc_nmiss);
+  printf("  dcache hits %l, negative hits %l, misses %l",
+         ks1.dc_nhit - ks0.dc_nhit, ks1.dc_nneg - ks0.dc_nneg,
+         ks1.dc_nmiss - ks0.dc_nmiss);
+  if(nlookup > 0)
+    printf(" (%l%% hit)", ((ks1.dc_nhit - ks0.dc_nhit) +
+                          (ks1.dc_nneg - ks0.dc_nneg)) * 100 / nlookup);
+  printf("\n");
+  printf("  exec pages shared %l, copied %l\n",
+         ks1.exec_nshared - ks0.exec_nshared, ks1.exec_ncopied - ks0.exec_ncopied);
+}
+
+// Run n copies of busy at once, each for ticks ticks, and report
+// the memory they use between them, as kpages() sees it. exec()
+// maps their text from the page cache, so the copies share it,
+// and each one should need little more than its stack, data and
+// page tables.
+void
+execmem(int n, char *ticks)
+{
+  char *argv[] = { "busy", "fsb", ticks, 0 };
+  struct kstats ks0, ks1;
+  int p0, p1, start, elapsed;
+
+  kstats(&ks0);
+  p0 = kpages();
+  start = uptime();
+  for(int i = 0; i < n; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("fsbench: fork failed\n");
+      exit(-1);
+    }
+    if(pid == 0){
+      close(1);
+      close(2);
+      exec("busy", argv);
+      exit(-1);
+    }
+  }
+  elapsed = uptime() - start;
+  sleep(atoi(ticks) / 2);
+  p1 = kpages();
+  kstats(&ks1);
+  for(int i = 0; i < n; i++)
+    wait(0);
+
+  printf("execmem: %d x busy started in %d ticks, using %d pages",
+         n, elapsed, p0 - p1);
+  if(n > 0)
+    printf(" (%d each)", (p0 - p1) / n);
+  printf("\n");
+  printf("  exec pages shared %l, copied %l\n",
+         ks1.exec_nshared - ks0.exec_nshared, ks1.exec_ncopied - ks0.exec_ncopied);
+}
+
+void
+usage(void)
+{
+  printf("usage: fsbench read [nprocs] [nblocks] [rounds]\n");
+  printf("       fsbench reread [nblocks] [rounds]\n");
+  printf("       fsbench write [nblocks] [chunk]\n");
+  printf("       fsbench ops [nprocs] [nfiles]\n");
+  printf("       fsbench concreate [nprocs] [nfiles]\n");
+  printf("       fsbench big [mbytes]\n");
+  printf("       fsbench full [pct] [nfiles]\n");
+  printf("       fsbench open [nfiles] [rounds]\n");
+  printf("       fsbench dir [n]\n");
+  printf("       fsbench mmap [mbytes] [rounds] [file]\n");
+  printf("       fsbench scan [mbytes] [nfiles]\n");
+  printf("       fsbench cat [file]\n");
+  printf("       fsbench exec [file] [n]\n");
+  printf("       fsbench execmem [n] [ticks]\n");
+  exit(-1);
+}
+
+int
+main(int argc, char **argv)
+{
+  if(argc < 2)
+    usage();
+
+  if(strcmp(argv[1], "read") == 0){
+    parread(argc > 2 ? atoi(argv[2]) : 4, argc > 3 ? atoi(argv[3]) : 4,
+            argc > 4 ? atoi(argv[4]) : 200);
+  } else if(strcmp(argv[1], "reread") == 0){
+    reread(argc > 2 ? atoi(argv[2]) : 100, argc > 3 ? atoi(argv[3]) : 10);
+  } else if(strcmp(argv[1], "write") == 0){
+    seqwrite(argc > 2 ? atoi(argv[2]) : 200, argc > 3 ? atoi(argv[3]) : 1);
+  } else if(strcmp(argv[1], "ops") == 0){
+    ops(argc > 2 ? atoi(argv[2]) : 4, argc > 3 ? atoi(argv[3]) : 50, 0);
+  } else if(strcmp(argv[1], "concreate") == 0){
+    ops(argc > 2 ? atoi(argv[2]) : 4, argc > 3 ? atoi(argv[3]) : 50, 1);
+  } else if(strcmp(argv[1], "big") == 0){
+    bigfile(argc > 2 ? atoi(argv[2]) : 8);
+  } else if(strcmp(argv[1], "full") == 0){
+    full(argc > 2 ? atoi(argv[2]) : 90, argc > 3 ? atoi(argv[3]) : 100);
+  } else if(strcmp(argv[1], "open") == 0){
+    openclose(argc > 2 ? atoi(argv[2]) : 20, argc > 3 ? atoi(argv[3]) : 50);
+  } else if(strcmp(argv[1], "dir") == 0){
+    dirbench(argc > 2 ? atoi(argv[2]) : 1000);
+  } else if(strcmp(argv[1], "mmap") == 0){
+    mmapscan(argc > 4 ? argv[4] : 0, argc > 2 ? atoi(argv[2]) : 2,
+             argc > 3 ? atoi(argv[3]) : 5);
+  } else if(strcmp(argv[1], "scan") == 0){
+    scanmeta(argc > 2 ? atoi(argv[2]) : 8, argc > 3 ? atoi(argv[3]) : 20);
+  } else if(strcmp(argv[1], "cat") == 0){
+    seqread(argc > 2 ? argv[2] : "usertests");
+  } else if(strcmp(argv[1], "exec") == 0){
+    exectime(argc > 2 ? argv[2] : "usertests", argc > 3 ? atoi(argv[3]) : 10);
+  } else if(strcmp(argv[1], "execmem") == 0){
+    execmem(argc > 2 ? atoi(argv[2]) : 20, argc > 3 ? argv[3] : "100");
+  } else {
+    usage();
+  }
+
+  return 0;
+}
@@ -1,15 +1,33 @@
 #include "kernel/types.h"
 #include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/kstats.h"
 #include "user/user.h"
 
+struct kstats ks;
+
 int
 main(int argc, char **argv)
 {
-  int amt;
+  int amt, big;
 
   amt = kpages();
 
   printf("kpages() = %d\n", amt);
 
+  if(kstats(&ks) < 0)
+    return 0;
+
+  // Free blocks of each order. Pages in the per-hart caches
+  // cannot coalesce until they are drained.
+  printf("cached: %l\n", ks.kalloc_ncached);
+  big = -1;
+  for(int k = 0; k <= MAXORDER; k++){
+    printf("order %d: %l\n", k, ks.kalloc_nblock[k]);
+    if(ks.kalloc_nblock[k] > 0)
+      big = k;
+  }
+  printf("largest free block: %d pages\n", big < 0 ? 0 : 1 << big);
+
   return 0;
 }
@@ -0,0 +1,86 @@
+// kstats - print kernel statistics.
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/kstats.h"
+#include "user/user.h"
+
+struct kstats ks;
+
+int
+main(int argc, char **argv)
+{
+  if(kstats(&ks) < 0){
+    printf("kstats - kstats() failed\n");
+    exit(-1);
+  }
+
+  printf("timer\n");
+  printf("  fired           : %l\n", ks.timer_fired);
+  printf("  wakeups avoided : %l\n", ks.timer_avoided);
+  printf("  latency total   : %l\n", ks.timer_lat_sum);
+  printf("  latency max     : %l\n", ks.timer_lat_max);
+  printf("kalloc\n");
+  printf("  allocations     : %l\n", ks.kalloc_nalloc);
+  printf("  refills         : %l\n", ks.kalloc_nrefill);
+  printf("  drains          : %l\n", ks.kalloc_ndrain);
+  printf("  steals          : %l\n", ks.kalloc_nsteal);
+  printf("  kmem.lock       : %l acquired, %l contended\n",
+         ks.kmem_nacquire, ks.kmem_ncontend);
+  printf("bcache\n");
+  printf("  hits            : %l\n", ks.bcache_nhit);
+  printf("  misses          : %l\n", ks.bcache_nmiss);
+  printf("  evictions       : %l\n", ks.bcache_nevict);
+  printf("  read ahead      : %l (%l used)\n", ks.bcache_nra, ks.bcache_nrahit);
+  printf("  buffers         : %l (%l added, %l freed)\n",
+         ks.bcache_nbuf, ks.bcache_ngrow, ks.bcache_nshrink);
+  printf("  locks           : %l acquired, %l contended\n",
+         ks.bcache_nacquire, ks.bcache_ncontend);
+  printf("log\n");
+  printf("  size            : %l blocks\n", ks.log_size);
+  printf("  operations      : %l\n", ks.log_nop);
+  printf("  commits         : %l (%l blocks, %l ticks)\n",
+         ks.log_ncommit, ks.log_nblocks, ks.log_nticks);
+  printf("  checkpoints     : %l (%l blocks)\n", ks.log_nckpt, ks.log_nckptblocks);
+  printf("fs\n");
+  printf("  blocks          : %l free of %l\n", ks.fs_nfree, ks.fs_size);
+  printf("  inodes          : %l free of %l\n", ks.fs_nifree, ks.fs_ninodes);
+  printf("  balloc          : %l (%l bitmap blocks read)\n",
+         ks.fs_nballoc, ks.fs_nbscan);
+  printf("  ialloc          : %l (%l inode blocks read)\n",
+         ks.fs_nialloc, ks.fs_niscan);
+  printf("  namei           : %l (%l cycles)\n", ks.fs_nnamei, ks.fs_nameitime);
+  printf("  dir indexes     : %l built, %l dirents probed\n",
+         ks.fs_ndxbuild, ks.fs_ndxprobe);
+  printf("inodes\n");
+  printf("  iget            : %l hit, %l miss, %l evicted\n",
+         ks.inode_nhit, ks.inode_nmiss, ks.inode_nevict);
+  printf("  ilock reads     : %l\n", ks.inode_nread);
+  printf("  cached          : %l (%l unreferenced)\n", ks.inode_n, ks.inode_nlru);
+  printf("pcache\n");
+  printf("  pcget           : %l hit, %l miss, %l evicted\n",
+         ks.pc_nhit, ks.pc_nmiss, ks.pc_nevict);
+  printf("  read ahead      : %l\n", ks.pc_nra);
+  printf("  pages           : %l\n", ks.pc_npage);
+  printf("  mmap faults     : %l\n", ks.mmap_nfault);
+  printf("  exec pages      : %l shared, %l copied\n",
+         ks.exec_nshared, ks.exec_ncopied);
+  printf("dcache\n");
+  printf("  lookups         : %l hit, %l negative, %l miss\n",
+         ks.dc_nhit, ks.dc_nneg, ks.dc_nmiss);
+  printf("  evictions       : %l\n", ks.dc_nevict);
+  printf("disk\n");
+  printf("  requests        : %l (%l blocks, %l written)\n", ks.disk_nreq,
+         ks.disk_nblocks, ks.disk_nwrite);
+  printf("  queue depth     :");
+  for(int i = 0; i < NQDEPTH; i++)
+    printf(" %l", ks.disk_qdepth[i]);
+  printf("\n");
+  printf("slab\t\tsize\tin use\tcached\tbytes\n");
+  for(int i = 0; i < NSLAB && ks.slab[i].name[0]; i++){
+    printf("  %s\t\t%l\t%l\t%l\t%l\n", ks.slab[i].name, ks.slab[i].size,
+           ks.slab[i].ninuse, ks.slab[i].ncached, ks.slab[i].nslab * 4096);
+  }
+
+  return 0;
+}
@@ -5,7 +5,7 @@
 int
 main(int argc, char **argv)
 {
-  int nbytes;
+  int nbytes, p1, p2;
   char *mem;
 
   if(argc != 2){
@@ -14,13 +14,16 @@ main(int argc, char **argv)
   }
 
   nbytes = atoi(argv[1]);
+  p1 = kpages();
   mem = sbrk(nbytes);
+  p2 = kpages();
 
   if((mem) == (char*)-1){
     printf("memalloc - sbrk(%d) failed\n", nbytes);
     exit(-1);
   }
-  printf("memalloc - sbrk(%d) succeeded\n", nbytes);
+  printf("memalloc - sbrk(%d) succeeded, %d pages allocated\n",
+         nbytes, p1 - p2);
   
   return 0;
 }
@@ -0,0 +1,158 @@
+// membench - measure fork/exec cost and memory use.
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/kstats.h"
+#include "user/user.h"
+
+// fork() and exec() a program that exits at once, n times, the
+// way sh runs every command.
+void
+forkexec(int n)
+{
+  char *argv[] = { "membench", "nop", 0 };
+  int start, elapsed;
+
+  start = uptime();
+  for(int i = 0; i < n; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("membench: fork failed\n");
+      exit(-1);
+    }
+    if(pid == 0){
+      exec(argv[0], argv);
+      printf("membench: exec failed\n");
+      exit(-1);
+    }
+    wait(0);
+  }
+  elapsed = uptime() - start;
+
+  printf("forkexec: %d fork+exec in %d ticks", n, elapsed);
+  if(elapsed > 0)
+    printf(" (%d/tick)", n / elapsed);
+  printf("\n");
+}
+
+// Grow the heap by npages touched pages, then count the free pages
+// a fork() of this process consumes while the child is alive.
+void
+forkmem(int npages)
+{
+  int fds[2];
+  int before, after;
+  char *p, c;
+
+  p = sbrk(npages * 4096);
+  if(p == (char*)-1){
+    printf("membench: sbrk failed\n");
+    exit(-1);
+  }
+  memset(p, 'a', npages * 4096);
+
+  if(pipe(fds) < 0){
+    printf("membench: pipe failed\n");
+    exit(-1);
+  }
+
+  before = kpages();
+  if(fork() == 0){
+    // Stay alive without touching memory until the parent is done.
+    close(fds[1]);
+    read(fds[0], &c, 1);
+    exit(0);
+  }
+  after = kpages();
+  close(fds[0]);
+  close(fds[1]);
+  wait(0);
+
+  printf("forkmem: fork of a %d-page heap used %d pages\n",
+         npages, before - after);
+}
+
+// Run nprocs processes that each, iters times, grow the heap by
+// npages, touch every page, fork a child that writes to the heap
+// and exits, and shrink the heap again. Every page fault, fork and
+// exit goes through kalloc()/kfree(). Boot with make CPUS=1, 2, 4
+// and 8 to see how the page allocator scales with the number of
+// harts.
+void
+stress(int nprocs, int iters, int npages)
+{
+  struct kstats ks0, ks1;
+  int start, elapsed;
+  uint64 nalloc, nacquire;
+
+  kstats(&ks0);
+  start = uptime();
+  for(int i = 0; i < nprocs; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("membench: fork failed\n");
+      exit(-1);
+    }
+    if(pid == 0){
+      for(int j = 0; j < iters; j++){
+        char *p = sbrk(npages * 4096);
+        if(p == (char*)-1)
+          exit(1);
+        for(int k = 0; k < npages; k++)
+          p[k * 4096] = k;
+        int pid1 = fork();
+        if(pid1 < 0)
+          exit(1);
+        if(pid1 == 0){
+          p[0] = 1;
+          exit(0);
+        }
+        wait(0);
+        sbrk(-npages * 4096);
+      }
+      exit(0);
+    }
+  }
+  for(int i = 0; i < nprocs; i++)
+    wait(0);
+  elapsed = uptime() - start;
+  kstats(&ks1);
+
+  nalloc = ks1.kalloc_nalloc - ks0.kalloc_nalloc;
+  nacquire = ks1.kmem_nacquire - ks0.kmem_nacquire;
+  printf("stress: %d procs x %d rounds of %d pages in %d ticks\n",
+         nprocs, iters, npages, elapsed);
+  printf("  kalloc %l", nalloc);
+  if(elapsed > 0)
+    printf(" (%l/tick)", nalloc / elapsed);
+  printf("\n");
+  printf("  kmem.lock acquired %l, contended %l\n",
+         nacquire, ks1.kmem_ncontend - ks0.kmem_ncontend);
+  printf("  refills %l, drains %l, steals %l\n",
+         ks1.kalloc_nrefill - ks0.kalloc_nrefill,
+         ks1.kalloc_ndrain - ks0.kalloc_ndrain,
+         ks1.kalloc_nsteal - ks0.kalloc_nsteal);
+}
+
+int
+main(int argc, char **argv)
+{
+  if(argc >= 2 && strcmp(argv[1], "nop") == 0)
+    exit(0);
+
+  if(argc >= 2 && strcmp(argv[1], "forkexec") == 0){
+    forkexec(argc > 2 ? atoi(argv[2]) : 100);
+  } else if(argc >= 2 && strcmp(argv[1], "forkmem") == 0){
+    forkmem(argc > 2 ? atoi(argv[2]) : 256);
+  } else if(argc >= 2 && strcmp(argv[1], "stress") == 0){
+    stress(argc > 2 ? atoi(argv[2]) : 8, argc > 3 ? atoi(argv[3]) : 100,
+           argc > 4 ? atoi(argv[4]) : 16);
+  } else {
+    printf("usage: membench forkexec [n]\n");
+    printf("       membench forkmem [npages]\n");
+    printf("       membench stress [nprocs] [iters] [npages]\n");
+    exit(-1);
+  }
+
+  return 0;
+}
@@ -0,0 +1,283 @@
+// schedbench - measure container scheduling fairness and
+// context-switch overhead.
+
+#include "kernel/types.h"
+#include "kernel/cinfo.h"
+#include "kernel/param.h"
+#include "kernel/kstats.h"
+#include "user/user.h"
+
+#define NWORKERS 4
+
+struct cinfo cinfo_ar[NCONT];
+
+// Spin until ticks have passed.
+void
+spin(int ticks)
+{
+  int start = uptime();
+
+  while(uptime() - start < ticks)
+    ;
+}
+
+// Start a container running nworkers CPU-bound processes for ticks.
+int
+startcont(char *cname, int weight, int nworkers, int ticks)
+{
+  int id;
+
+  id = cfork(cname, 0, "/", 0);
+  if(id < 0){
+    printf("schedbench: cfork(%s) failed\n", cname);
+    exit(-1);
+  }
+  if(id == 0){
+    for(int i = 0; i < nworkers; i++){
+      if(fork() == 0){
+        sname(cname);
+        spin(ticks);
+        exit(0);
+      }
+    }
+    for(int i = 0; i < nworkers; i++)
+      wait(0);
+    exit(0);
+  }
+
+  if(cweight(cname, weight) < 0)
+    printf("schedbench: cweight(%s) failed\n", cname);
+
+  return id;
+}
+
+// Return the nticks charged so far to the named container.
+int
+contticks(char *cname)
+{
+  memset(cinfo_ar, 0, sizeof(cinfo_ar));
+  if(cinfo(cinfo_ar) < 0){
+    printf("schedbench: cinfo() failed\n");
+    exit(-1);
+  }
+  for(int i = 0; i < NCONT; i++){
+    if(cinfo_ar[i].state != 0 && strcmp(cinfo_ar[i].name, cname) == 0)
+      return cinfo_ar[i].nticks;
+  }
+  return 0;
+}
+
+// Run two busy containers with weights wa and wb and report the ticks
+// each one received, normalized by weight, as a Jain fairness index
+// (1000 is perfectly fair).
+void
+fairness(int wa, int wb, int ticks)
+{
+  int a, b;
+  uint64 xa, xb, jain;
+
+  startcont("sb_a", wa, NWORKERS, ticks);
+  startcont("sb_b", wb, NWORKERS, ticks);
+
+  // Sample before the workers finish and the containers are freed.
+  sleep(ticks * 3 / 4);
+  a = contticks("sb_a");
+  b = contticks("sb_b");
+
+  wait(0);
+  wait(0);
+
+  xa = (uint64)a * 1000 / wa;
+  xb = (uint64)b * 1000 / wb;
+  if(xa + xb == 0)
+    jain = 0;
+  else
+    jain = (xa + xb) * (xa + xb) * 1000 / (2 * (xa * xa + xb * xb));
+
+  printf("fairness: weight %d/%d nticks %d/%d jain %l/1000\n",
+         wa, wb, a, b, jain);
+}
+
+// Bounce one byte between two processes over a pair of pipes. Every
+// round trip is two context switches.
+void
+ctxsw(int rounds)
+{
+  int ab[2], ba[2];
+  int start, elapsed, pid;
+  char c = 'x';
+
+  if(pipe(ab) < 0 || pipe(ba) < 0){
+    printf("schedbench: pipe() failed\n");
+    exit(-1);
+  }
+
+  pid = fork();
+  if(pid == 0){
+    for(int i = 0; i < rounds; i++){
+      read(ab[0], &c, 1);
+      write(ba[1], &c, 1);
+    }
+    exit(0);
+  }
+
+  start = uptime();
+  for(int i = 0; i < rounds; i++){
+    write(ab[1], &c, 1);
+    read(ba[0], &c, 1);
+  }
+  elapsed = uptime() - start;
+  wait(0);
+
+  close(ab[0]);
+  close(ab[1]);
+  close(ba[0]);
+  close(ba[1]);
+
+  printf("ctxsw: %d round trips in %d ticks", rounds, elapsed);
+  if(elapsed > 0)
+    printf(" (%d switches/tick)", 2 * rounds / elapsed);
+  printf("\n");
+}
+
+// Run the pipe ping-pong with nidle other processes blocked reading a
+// pipe. Every wakeup used to lock every proc, so the idle processes
+// slow down all the wakeups the ping-pong does.
+void
+idle(int nidle, int rounds)
+{
+  int fds[2];
+  char c;
+  int n;
+
+  if(pipe(fds) < 0){
+    printf("schedbench: pipe() failed\n");
+    exit(-1);
+  }
+
+  for(n = 0; n < nidle; n++){
+    int pid = fork();
+    if(pid < 0)
+      break;
+    if(pid == 0){
+      close(fds[1]);
+      read(fds[0], &c, 1);
+      exit(0);
+    }
+  }
+  close(fds[0]);
+
+  printf("idle: %d sleeping processes\n", n);
+  ctxsw(rounds);
+
+  // Wake the idle processes by closing the last write end.
+  close(fds[1]);
+  for(; n > 0; n--)
+    wait(0);
+}
+
+// Run nsleepers processes that each call sleep(len) until ticks have
+// passed, like busymany -s, and report what the timer wheel did.
+void
+sleepers(int nsleepers, int len, int ticks)
+{
+  struct kstats ks0, ks1;
+  uint64 fired;
+
+  kstats(&ks0);
+  for(int i = 0; i < nsleepers; i++){
+    int pid = fork();
+    if(pid < 0)
+      break;
+    if(pid == 0){
+      int start = uptime();
+      while(uptime() - start < ticks)
+        sleep(len);
+      exit(0);
+    }
+  }
+  for(int i = 0; i < nsleepers; i++)
+    wait(0);
+  kstats(&ks1);
+
+  fired = ks1.timer_fired - ks0.timer_fired;
+  printf("sleep: %d sleepers x sleep(%d) for %d ticks\n", nsleepers, len, ticks);
+  printf("  timers fired %l, wakeups avoided %l\n",
+         fired, ks1.timer_avoided - ks0.timer_avoided);
+  printf("  fire latency total %l max %l ticks\n",
+         ks1.timer_lat_sum - ks0.timer_lat_sum, ks1.timer_lat_max);
+}
+
+// Several processes fork and reap children as fast as they can, like
+// forkfork in usertests. Boot with make CPUS=1, 2, 4 and 8 to see how
+// fork/exit/wait throughput scales with the number of harts.
+void
+forkfork(int nprocs, int nforks)
+{
+  int start, elapsed;
+
+  start = uptime();
+  for(int i = 0; i < nprocs; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("schedbench: fork failed\n");
+      exit(-1);
+    }
+    if(pid == 0){
+      for(int j = 0; j < nforks; j++){
+        int pid1 = fork();
+        if(pid1 < 0)
+          exit(1);
+        if(pid1 == 0)
+          exit(0);
+        wait(0);
+      }
+      exit(0);
+    }
+  }
+
+  for(int i = 0; i < nprocs; i++)
+    wait(0);
+  elapsed = uptime() - start;
+
+  printf("forkfork: %d procs x %d forks in %d ticks", nprocs, nforks, elapsed);
+  if(elapsed > 0)
+    printf(" (%d forks/tick)", nprocs * nforks / elapsed);
+  printf("\n");
+}
+
+void
+usage(void)
+{
+  printf("usage: schedbench fair [ticks] [weight_b]\n");
+  printf("       schedbench ctxsw [rounds]\n");
+  printf("       schedbench idle [nidle] [rounds]\n");
+  printf("       schedbench sleep [nsleepers] [len] [ticks]\n");
+  printf("       schedbench forkfork [nprocs] [nforks]\n");
+  exit(-1);
+}
+
+int
+main(int argc, char **argv)
+{
+  if(argc < 2)
+    usage();
+
+  if(strcmp(argv[1], "fair") == 0){
+    fairness(CWEIGHT, argc > 3 ? atoi(argv[3]) : CWEIGHT,
+             argc > 2 ? atoi(argv[2]) : 50);
+  } else if(strcmp(argv[1], "ctxsw") == 0){
+    ctxsw(argc > 2 ? atoi(argv[2]) : 1000);
+  } else if(strcmp(argv[1], "idle") == 0){
+    idle(argc > 2 ? atoi(argv[2]) : 56, argc > 3 ? atoi(argv[3]) : 1000);
+  } else if(strcmp(argv[1], "sleep") == 0){
+    sleepers(argc > 2 ? atoi(argv[2]) : 16, argc > 3 ? atoi(argv[3]) : 5,
+             argc > 4 ? atoi(argv[4]) : 100);
+  } else if(strcmp(argv[1], "forkfork") == 0){
+    forkfork(argc > 2 ? atoi(argv[2]) : 4, argc > 3 ? atoi(argv[3]) : 200);
+  } else {
+    usage();
+  }
+
+  return 0;
+}
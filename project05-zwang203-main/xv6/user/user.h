@@ -6,6 +6,7 @@
 struct stat;
 struct uproc;
 struct cinfo;
+struct kstats;
 
 // system calls
 int fork(void);
@@ -35,6 +36,11 @@ int sproc(int, struct uproc*);
 int consw(int);
 int cfork(const char*, int, char *, int);
 int cinfo(struct cinfo*);
+int cweight(const char*, int);
+int kstats(struct kstats*);
+int kpages(void);
+void *mmap(void*, int, int, int, int, int);
+int munmap(void*, int);
 
 // ulib.c
 int stat(const char*, struct stat*);
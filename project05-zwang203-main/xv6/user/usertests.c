@@ -575,9 +575,13 @@ writetest(char *s)
   }
 }
 
+// Write a file that fills the first indirect block under the
+// double-indirect block and starts on the second. A file of
+// MAXFILE blocks (64 MiB) would not fit on the default disk.
 void
 writebig(char *s)
 {
+  enum { NBIG = NDIRECT + NINDIRECT + NINDIRECT + 1 };
   int i, fd, n;
 
   fd = open("big", O_CREATE|O_RDWR);
@@ -586,7 +590,7 @@ writebig(char *s)
     exit(1);
   }
 
-  for(i = 0; i < MAXFILE; i++){
+  for(i = 0; i < NBIG; i++){
     ((int*)buf)[0] = i;
     if(write(fd, buf, BSIZE) != BSIZE){
       printf("%s: error: write big file failed\n", s, i);
@@ -606,7 +610,7 @@ writebig(char *s)
   for(;;){
     i = read(fd, buf, BSIZE);
     if(i == 0){
-      if(n == MAXFILE - 1){
+      if(n != NBIG){
         printf("%s: read only %d blocks from big", s, n);
         exit(1);
       }
@@ -629,6 +633,50 @@ writebig(char *s)
   }
 }
 
+// close a file that has indirect blocks, reopen it, and extend
+// it. the kernel only knows where the file's next block should go
+// by looking up its last one, which once deadlocked on the
+// indirect block when the inode had been read afresh from disk.
+void
+appendbig(char *s)
+{
+  int ends[] = { NDIRECT+1, NDIRECT+3, NDIRECT+NINDIRECT+1, NDIRECT+NINDIRECT+3 };
+  int i, j, fd, n;
+
+  unlink("appendbig");
+  n = 0;
+  for(i = 0; i < sizeof(ends)/sizeof(ends[0]); i++){
+    fd = open("appendbig", O_CREATE|O_RDWR);
+    if(fd < 0){
+      printf("%s: open appendbig failed\n", s);
+      exit(1);
+    }
+    // read up to the end, which is where writes go.
+    for(j = 0; j < n; j++){
+      if(read(fd, buf, BSIZE) != BSIZE || ((int*)buf)[0] != j){
+        printf("%s: appendbig block %d wrong\n", s, j);
+        exit(1);
+      }
+    }
+    if(read(fd, buf, BSIZE) != 0){
+      printf("%s: appendbig too long\n", s);
+      exit(1);
+    }
+    for(; n < ends[i]; n++){
+      ((int*)buf)[0] = n;
+      if(write(fd, buf, BSIZE) != BSIZE){
+        printf("%s: appendbig write %d failed\n", s, n);
+        exit(1);
+      }
+    }
+    close(fd);
+  }
+  if(unlink("appendbig") < 0){
+    printf("%s: unlink appendbig failed\n", s);
+    exit(1);
+  }
+}
+
 // many creates, followed by unlink test
 void
 createtest(char *s)
@@ -2544,6 +2592,70 @@ sbrklast(char *s)
 }
 
 
+// a program that is running cannot be opened for writing, and a
+// program that is open for writing cannot be run.
+void
+textbusy(char *s)
+{
+  int fd, wfd, n, pid, xstatus;
+  char *args[] = { "textbusy-echo", 0 };
+
+  // usertests itself is running.
+  fd = open("usertests", O_RDWR);
+  if(fd >= 0){
+    printf("%s: opened running usertests for writing\n", s);
+    exit(1);
+  }
+  if((fd = open("usertests", O_RDONLY)) < 0){
+    printf("%s: open usertests for reading failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  // a copy of echo, still open for writing.
+  if((fd = open("echo", O_RDONLY)) < 0){
+    printf("%s: open echo failed\n", s);
+    exit(1);
+  }
+  wfd = open("textbusy-echo", O_CREATE|O_TRUNC|O_WRONLY);
+  if(wfd < 0){
+    printf("%s: create textbusy-echo failed\n", s);
+    exit(1);
+  }
+  while((n = read(fd, buf, BUFSZ)) > 0){
+    if(write(wfd, buf, n) != n){
+      printf("%s: write textbusy-echo failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+
+  for(int i = 0; i < 2; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      close(1);  // no output from echo
+      exec("textbusy-echo", args);
+      exit(2);
+    }
+    wait(&xstatus);
+    if(i == 0 && xstatus != 2){
+      printf("%s: ran a program open for writing\n", s);
+      exit(1);
+    }
+    if(i == 1 && xstatus != 0){
+      printf("%s: could not run a closed program\n", s);
+      exit(1);
+    }
+    if(i == 0)
+      close(wfd);
+  }
+  unlink("textbusy-echo");
+}
+
 // does sbrk handle signed int32 wrap-around with
 // negative arguments?
 void
@@ -2571,6 +2683,338 @@ badarg(char *s)
   exit(0);
 }
 
+// create name with n bytes, byte i being 'a' + i % 26.
+void
+mapfile(char *s, char *name, int n)
+{
+  int fd, i, j, m;
+
+  unlink(name);
+  fd = open(name, O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create %s failed\n", s, name);
+    exit(1);
+  }
+  for(i = 0; i < n; i += m){
+    m = n - i < BUFSZ ? n - i : BUFSZ;
+    for(j = 0; j < m; j++)
+      buf[j] = 'a' + (i + j) % 26;
+    if(write(fd, buf, m) != m){
+      printf("%s: write %s failed\n", s, name);
+      exit(1);
+    }
+  }
+  close(fd);
+}
+
+// read all of name, which must fit, into buf.
+int
+readfile(char *s, char *name)
+{
+  int fd, n;
+
+  fd = open(name, O_RDONLY);
+  if(fd < 0){
+    printf("%s: open %s failed\n", s, name);
+    exit(1);
+  }
+  n = read(fd, buf, BUFSZ);
+  close(fd);
+  return n;
+}
+
+// check that touching a is fatal.
+void
+mapgone(char *s, char *a)
+{
+  int pid, xstatus;
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    printf("%s: oops could read %p = %x\n", s, a, *a);
+    exit(1);
+  }
+  wait(&xstatus);
+  if(xstatus != -1)  // did kernel kill child?
+    exit(1);
+}
+
+// stores to a MAP_SHARED mapping reach the file on munmap() and
+// on exit().
+void
+mmapshared(char *s)
+{
+  enum { N = 2*PGSIZE + 100 };
+  int fd, pid, xstatus;
+  char *p;
+
+  mapfile(s, "mmapshared", N);
+  fd = open("mmapshared", O_RDONLY);
+  if(mmap(0, N, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0) != (void*)-1){
+    printf("%s: shared writable mapping of read-only fd\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("mmapshared", O_RDWR);
+  p = mmap(0, N, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if(p == (char*)-1){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  for(int i = 0; i < N; i++){
+    if(p[i] != 'a' + i % 26){
+      printf("%s: byte %d of mapping is %x\n", s, i, p[i]);
+      exit(1);
+    }
+  }
+  p[0] = 'X';
+  p[PGSIZE+1] = 'Y';
+  p[N-1] = 'Z';
+  if(munmap(p, N) != 0){
+    printf("%s: munmap failed\n", s);
+    exit(1);
+  }
+  if(readfile(s, "mmapshared") != N || buf[0] != 'X' || buf[1] != 'b' ||
+     buf[PGSIZE+1] != 'Y' || buf[N-1] != 'Z'){
+    printf("%s: stores not written back on munmap\n", s);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    fd = open("mmapshared", O_RDWR);
+    p = mmap(0, N, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    if(p == (char*)-1)
+      exit(1);
+    p[2] = 'W';
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+  if(readfile(s, "mmapshared") != N || buf[2] != 'W'){
+    printf("%s: stores not written back on exit\n", s);
+    exit(1);
+  }
+  unlink("mmapshared");
+}
+
+// a child shares MAP_SHARED pages with its parent, and gets
+// copies of MAP_PRIVATE pages. stores to MAP_PRIVATE pages never
+// reach the file. until a MAP_PRIVATE page is written it is the
+// file's page, so the private stores go to other bytes.
+void
+mmapfork(char *s)
+{
+  enum { N = PGSIZE + 10 };
+  int fd, pid, xstatus;
+  char *sh, *pr;
+
+  mapfile(s, "mmapfork", N);
+  fd = open("mmapfork", O_RDWR);
+  sh = mmap(0, N, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  pr = mmap(0, N, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(sh == (char*)-1 || pr == (char*)-1){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  // map the first pages now, and leave the second ones for the
+  // child to fault in.
+  if(sh[0] != 'a' || pr[0] != 'a'){
+    printf("%s: wrong contents\n", s);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    sh[0] = 'C';
+    sh[PGSIZE] = 'D';
+    pr[2] = 'E';
+    pr[PGSIZE+2] = 'F';
+    if(pr[2] != 'E' || pr[1] != 'b')
+      exit(1);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child failed\n", s);
+    exit(1);
+  }
+  if(sh[0] != 'C' || sh[PGSIZE] != 'D'){
+    printf("%s: MAP_SHARED store by child not seen\n", s);
+    exit(1);
+  }
+  if(pr[2] != 'c' || pr[PGSIZE+2] != 'a' + (PGSIZE + 2) % 26){
+    printf("%s: MAP_PRIVATE store by child seen\n", s);
+    exit(1);
+  }
+  pr[1] = 'G';
+  munmap(pr, N);
+  munmap(sh, N);
+  if(readfile(s, "mmapfork") != N || buf[0] != 'C' || buf[1] != 'b' ||
+     buf[2] != 'c' || buf[PGSIZE] != 'D'){
+    printf("%s: wrong file contents\n", s);
+    exit(1);
+  }
+  unlink("mmapfork");
+}
+
+// munmap() of the start or end of a region, but not the middle.
+void
+mmapunmap(char *s)
+{
+  enum { N = 3*PGSIZE };
+  int fd;
+  char *p;
+
+  mapfile(s, "mmapunmap", N);
+  fd = open("mmapunmap", O_RDONLY);
+  p = mmap(0, N, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(p == (char*)-1){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  if(munmap(p + PGSIZE, PGSIZE) == 0){
+    printf("%s: munmap of the middle of a region\n", s);
+    exit(1);
+  }
+  if(munmap(p, PGSIZE) != 0 || munmap(p + 2*PGSIZE, PGSIZE) != 0){
+    printf("%s: munmap of an end failed\n", s);
+    exit(1);
+  }
+  if(p[PGSIZE] != 'a' + PGSIZE % 26){
+    printf("%s: wrong contents\n", s);
+    exit(1);
+  }
+  mapgone(s, p);
+  mapgone(s, p + 2*PGSIZE);
+  if(munmap(p + PGSIZE, PGSIZE) != 0){
+    printf("%s: munmap of the rest failed\n", s);
+    exit(1);
+  }
+  mapgone(s, p + PGSIZE);
+  unlink("mmapunmap");
+}
+
+// a mapping reads zeros past the end of the file in its last
+// page, and faults on pages wholly past it.
+void
+mmapeof(char *s)
+{
+  enum { N = 100 };
+  int fd;
+  char *p;
+
+  mapfile(s, "mmapeof", N);
+  fd = open("mmapeof", O_RDONLY);
+  p = mmap(0, 2*PGSIZE, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(p == (char*)-1){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  if(p[N-1] != 'a' + (N-1) % 26){
+    printf("%s: wrong contents\n", s);
+    exit(1);
+  }
+  for(int i = N; i < PGSIZE; i++){
+    if(p[i] != 0){
+      printf("%s: byte %d past EOF is %x\n", s, i, p[i]);
+      exit(1);
+    }
+  }
+  mapgone(s, p + PGSIZE);
+  munmap(p, 2*PGSIZE);
+  unlink("mmapeof");
+}
+
+// read() and write() to and from mapped pages that have not been
+// touched yet, through a pipe, whose lock is a spinlock, and
+// through the mapped file itself.
+void
+mmapcopy(char *s)
+{
+  enum { N = 2*PGSIZE };
+  int fd, fds[2];
+  char *sh, *pr, *ro;
+
+  mapfile(s, "mmapcopy", N);
+  fd = open("mmapcopy", O_RDWR);
+  sh = mmap(0, N, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  pr = mmap(0, N, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  ro = mmap(0, N, PROT_READ, MAP_PRIVATE, fd, 0);
+  if(sh == (char*)-1 || pr == (char*)-1 || ro == (char*)-1){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+
+  // the file into a private mapping of itself.
+  if(read(fd, pr, N) != N){
+    printf("%s: read into mapping failed\n", s);
+    exit(1);
+  }
+  for(int i = 0; i < N; i++){
+    if(pr[i] != 'a' + i % 26){
+      printf("%s: byte %d read into mapping is %x\n", s, i, pr[i]);
+      exit(1);
+    }
+  }
+  close(fd);
+  fd = open("mmapcopy", O_RDONLY);
+  if(read(fd, ro, 1) >= 0){
+    printf("%s: read into read-only mapping\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  // from a mapping into a pipe, and from the pipe into a
+  // mapping, across a page boundary.
+  if(pipe(fds) < 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  if(write(fds[1], ro + PGSIZE - 3, 6) != 6){
+    printf("%s: write from mapping failed\n", s);
+    exit(1);
+  }
+  if(read(fds[0], sh + PGSIZE - 2, 6) != 6){
+    printf("%s: read into mapping failed\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+  for(int i = 0; i < 6; i++){
+    if(sh[PGSIZE - 2 + i] != 'a' + (PGSIZE - 3 + i) % 26){
+      printf("%s: byte %d through pipe is %x\n", s, i, sh[PGSIZE - 2 + i]);
+      exit(1);
+    }
+  }
+  munmap(sh, N);
+  munmap(pr, N);
+  munmap(ro, N);
+  if(readfile(s, "mmapcopy") != N || buf[PGSIZE+3] != 'a' + (PGSIZE + 2) % 26){
+    printf("%s: wrong file contents\n", s);
+    exit(1);
+  }
+  unlink("mmapcopy");
+}
+
 struct test {
   void (*f)(char *);
   char *s;
@@ -2590,6 +3034,7 @@ struct test {
   {opentest, "opentest"},
   {writetest, "writetest"},
   {writebig, "writebig"},
+  {appendbig, "appendbig"},
   {createtest, "createtest"},
   {dirtest, "dirtest"},
   {exectest, "exectest"},
@@ -2635,6 +3080,12 @@ struct test {
   {sbrklast, "sbrklast"},
   {sbrk8000, "sbrk8000"},
   {badarg, "badarg" },
+  {textbusy, "textbusy"},
+  {mmapshared, "mmapshared"},
+  {mmapfork, "mmapfork"},
+  {mmapunmap, "mmapunmap"},
+  {mmapeof, "mmapeof"},
+  {mmapcopy, "mmapcopy"},
 
   { 0, 0},
 };
@@ -43,3 +43,8 @@ entry("sproc");
 entry("consw");
 entry("cfork");
 entry("cinfo");
+entry("cweight");
+entry("kstats");
+entry("kpages");
+entry("mmap");
+entry("munmap");